@@ -0,0 +1,188 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define MAX_WORD_LEN 12
+#define WORDS_PER_LINE 12
+
+/*
+Program Description: writes a synthetic text corpus for the benchmark suite. The corpus has
+a fixed size in bytes (-s), is drawn from a vocabulary of a fixed number of distinct words
+(-v), and picks words with a Zipf distribution of exponent 'skew' (-z), so the word at rank r
+is drawn with a probability proportional to 1 / r^skew, like word frequencies in real text.
+The same seed (-r) always produces byte-for-byte the same corpus, so benchmark runs on
+different machines or commits read identical input. Words are a pure function of (seed,
+rank) and distinct ranks give distinct words, so -q, which lists the words of the ranks just
+past the vocabulary, yields query words that are guaranteed to be absent from the corpus.
+*/
+
+/*
+Function Description: the splitmix64 generator, used both as the corpus's random number
+generator (by advancing 'state') and as a mixing function to derive words from ranks.
+*/
+uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/*
+Function Description: writes the word of the given 'rank' into 'word' and returns its length.
+The word starts with the rank in base 16 spelled with the letters 'a' to 'p', followed by
+random filler letters from 'q' to 'z' up to a length of 3 to MAX_WORD_LEN letters taken from
+a hash of the seed and the rank. The filler never uses a digit letter, so the rank can be
+read back from the word and no two ranks share a word, and the vocabulary never has to be
+stored.
+*/
+int make_word(uint64_t seed, int rank, char *word) {
+    uint64_t state = seed ^ ((uint64_t)rank * 0xd1b54a32d192ed03ULL);
+    int len = 3 + (int)(splitmix64(&state) % (MAX_WORD_LEN - 2));
+    int pos = 0;
+
+    for (int r = rank; ; r /= 16) {
+        word[pos++] = 'a' + r % 16;
+        if (r < 16) {
+            break;
+        }
+    }
+    while (pos < len) {
+        word[pos++] = 'q' + splitmix64(&state) % 10;
+    }
+    word[pos] = '\0';
+    return pos;
+}
+
+/*
+Function Description: fills 'cdf' with the cumulative Zipf probabilities of ranks 1 to
+'vocabulary' for exponent 'skew', so that a uniform number u in [0, 1) selects the first
+rank whose cdf exceeds u. Returns 1 on success and 0 if the table could not be allocated.
+*/
+int build_zipf_cdf(int vocabulary, double skew, double **cdf) {
+    *cdf = (double *)malloc(vocabulary * sizeof(double));
+    if (*cdf == NULL) {
+        return 0;
+    }
+    double total = 0.0;
+    for (int r = 0; r < vocabulary; r++) {
+        total += 1.0 / pow(r + 1, skew);
+        (*cdf)[r] = total;
+    }
+    for (int r = 0; r < vocabulary; r++) {
+        (*cdf)[r] /= total;
+    }
+    return 1;
+}
+
+/*
+Function Description: draws one rank from the Zipf table with a binary search.
+*/
+int sample_rank(const double *cdf, int vocabulary, uint64_t *state) {
+    double u = (splitmix64(state) >> 11) * (1.0 / 9007199254740992.0);
+    int low = 0, high = vocabulary - 1;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (cdf[mid] > u) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return low;
+}
+
+void print_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-s bytes] [-v vocabulary] [-z skew] [-r seed] [-q count] [-o file]\n", program);
+    fprintf(stderr, "  -s  corpus size in bytes (default 16000000)\n");
+    fprintf(stderr, "  -v  number of distinct words to draw from (default 100000)\n");
+    fprintf(stderr, "  -z  Zipf exponent, 0 for uniform (default 1.0)\n");
+    fprintf(stderr, "  -r  seed; the same seed gives the same corpus (default 1)\n");
+    fprintf(stderr, "  -q  instead of a corpus, write 'count' words that are not in it, one per line\n");
+    fprintf(stderr, "  -o  output file (default stdout)\n");
+}
+
+int main(int argc, char *argv[]) {
+    long long size = 16000000;
+    int vocabulary = 100000;
+    double skew = 1.0;
+    uint64_t seed = 1;
+    int num_queries = 0;
+    const char *output = NULL;
+
+    int option;
+    while ((option = getopt(argc, argv, "s:v:z:r:q:o:")) != -1) {
+        switch (option) {
+            case 's':
+                size = atoll(optarg);
+                break;
+            case 'v':
+                vocabulary = atoi(optarg);
+                break;
+            case 'z':
+                skew = atof(optarg);
+                break;
+            case 'r':
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'q':
+                num_queries = atoi(optarg);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    if (vocabulary < 1 || size < 0 || skew < 0.0 || num_queries < 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    FILE *file = output != NULL ? fopen(output, "w") : stdout;
+    if (file == NULL) {
+        perror("There's an error opening this text file");
+        return 1;
+    }
+
+    char word[MAX_WORD_LEN + 16];
+    if (num_queries > 0) {
+        for (int r = vocabulary; r < vocabulary + num_queries; r++) {
+            make_word(seed, r, word);
+            fprintf(file, "%s\n", word);
+        }
+    } else {
+        double *cdf;
+        if (!build_zipf_cdf(vocabulary, skew, &cdf)) {
+            perror("Memory allocation has failed");
+            return 1;
+        }
+        uint64_t state = seed;
+        long long written = 0;
+        int on_line = 0;
+        while (written < size) {
+            int len = make_word(seed, sample_rank(cdf, vocabulary, &state), word);
+            char separator = ++on_line == WORDS_PER_LINE ? '\n' : ' ';
+            if (written + len + 1 > size) {
+                break;
+            }
+            fwrite(word, 1, len, file);
+            fputc(separator, file);
+            written += len + 1;
+            if (separator == '\n') {
+                on_line = 0;
+            }
+        }
+        free(cdf);
+    }
+
+    if (file != stdout && fclose(file) != 0) {
+        perror("There's an error opening this text file");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,103 @@
+#!/bin/sh
+# Benchmark suite: generates a deterministic synthetic corpus with bench/corpus_gen, runs the
+# serial program and every mode of the parallel program on it for 1 to N threads, repeating
+# each run R times, and writes the median of every "metric <name> <value>" line the programs
+# print with -m to a CSV file (engine,threads,metric,median). Raw per-run numbers are kept
+# next to it, so a result can always be traced back to the runs it came from.
+#
+# Usage: bench/run_bench.sh [-s bytes] [-v vocabulary] [-z skew] [-r seed] [-n files]
+#                           [-R repeats] [-t max_threads] [-o out_dir]
+# Run it from the repository root after `make` (or just use `make bench`).
+
+set -eu
+
+size=16000000
+vocabulary=100000
+skew=1.0
+seed=1
+num_files=4
+repeats=5
+max_threads=$(nproc 2>/dev/null || echo 1)
+out_dir=bench/out
+
+while getopts "s:v:z:r:n:R:t:o:" option; do
+    case $option in
+        s) size=$OPTARG ;;
+        v) vocabulary=$OPTARG ;;
+        z) skew=$OPTARG ;;
+        r) seed=$OPTARG ;;
+        n) num_files=$OPTARG ;;
+        R) repeats=$OPTARG ;;
+        t) max_threads=$OPTARG ;;
+        o) out_dir=$OPTARG ;;
+        *) sed -n '8,9p' "$0" >&2; exit 1 ;;
+    esac
+done
+
+for program in ./bloom_filter_parallelize ./bloom_filter_serialise ./bench/corpus_gen; do
+    if [ ! -x "$program" ]; then
+        echo "$program is missing, run make first" >&2
+        exit 1
+    fi
+done
+
+mkdir -p "$out_dir"
+
+# the corpus is num_files files of size / num_files bytes each, every one with its own seed,
+# so the file-parallel mode has several files to spread over the threads
+corpus=""
+for i in $(seq 1 "$num_files"); do
+    file="$out_dir/corpus_$i.txt"
+    ./bench/corpus_gen -s $((size / num_files)) -v "$vocabulary" -z "$skew" -r $((seed + i)) -o "$file"
+    corpus="$corpus $file"
+done
+queries="$out_dir/queries.txt"
+./bench/corpus_gen -v "$vocabulary" -r $((seed + 1)) -q 1000000 -o "$queries"
+
+# thread counts: powers of two up to max_threads, plus max_threads itself
+thread_counts=""
+t=1
+while [ "$t" -lt "$max_threads" ]; do
+    thread_counts="$thread_counts $t"
+    t=$((t * 2))
+done
+thread_counts="$thread_counts $max_threads"
+
+raw="$out_dir/raw.csv"
+results="$out_dir/results.csv"
+echo "engine,threads,run,metric,value" > "$raw"
+
+# run_engine name threads command...: runs the command 'repeats' times and appends its metrics
+run_engine() {
+    engine=$1
+    threads=$2
+    shift 2
+    for run in $(seq 1 "$repeats"); do
+        OMP_NUM_THREADS=$threads "$@" | awk -v engine="$engine" -v threads="$threads" -v run="$run" \
+            '$1 == "metric" && $2 != "threads" { print engine "," threads "," run "," $2 "," $3 }' >> "$raw"
+    done
+}
+
+run_engine serial 1 ./bloom_filter_serialise -m $corpus
+for threads in $thread_counts; do
+    echo "threads: $threads" >&2
+    run_engine files "$threads" ./bloom_filter_parallelize -m -q "$queries" $corpus
+    run_engine split "$threads" ./bloom_filter_parallelize -m -s -q "$queries" $corpus
+    run_engine split_blocked "$threads" ./bloom_filter_parallelize -m -s -f blocked -q "$queries" $corpus
+done
+
+# median over the runs of every (engine, threads, metric)
+echo "engine,threads,metric,median" > "$results"
+tail -n +2 "$raw" | sort -t, -k1,1 -k2,2n -k4,4 -k5,5g | awk -F, '
+    function flush() {
+        if (count > 0) {
+            median = count % 2 ? values[(count + 1) / 2] : (values[count / 2] + values[count / 2 + 1]) / 2
+            print key "," median
+        }
+        count = 0
+    }
+    { this_key = $1 "," $2 "," $4; if (this_key != key) { flush(); key = this_key } values[++count] = $5 }
+    END { flush() }' >> "$results"
+
+cat "$results"
+echo "medians of $repeats runs written to $results (raw runs in $raw)" >&2
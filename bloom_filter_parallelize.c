@@ -3,127 +3,4946 @@
 #include <stdio.h>
 #include <time.h>
 #include <math.h>
+#include <stdint.h>
+#include <limits.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <dirent.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include <omp.h>
 
 #define MAX_STRING_LEN 100
 #define MAX_FP_RATE 0.05
-#define NUM_HASH_FUNCTIONS 4
+#define MAX_HASH_FUNCTIONS 16
+#define MAX_SPECIALIZED_K 8
+#define HASH_SEED 0x9e3779b97f4a7c15ULL
+#define FP_TEST_WORDS 100000
+#define FP_TEST_MIN_WORDS 1000
+#define BLOCK_BITS 512
+#define COUNTER_BITS 4
+#define COUNTER_MAX 15
+#define QUERY_BATCH 64
+#define SCALABLE_INITIAL_CAPACITY 1024
+#define SCALABLE_GROWTH 2
+#define SCALABLE_TIGHTENING 0.8
+#define MAX_SLICES 20
+#define TOKEN_BATCH 1024
+#define PIPELINE_QUEUE_SIZE 64
+#define MERGE_CHUNK_WORDS 4096
+#define TOKENIZE_BATCH 256
+#define MAX_INSTRUMENTED_THREADS 256
+#define DAEMON_MAX_REQUEST (1 << 20)
+#define DAEMON_CLIENT_BATCH 1024
+#define TASK_BATCH_BYTES (1 << 20)
+#define SHARDS_PER_THREAD 8
+#define HLL_PRECISION 14
+#define HLL_REGISTERS (1 << HLL_PRECISION)
+#define HLL_MARGIN 0.05
+#define FILTER_FILE_MAGIC "BLOOMFLT"
+#define FILTER_FILE_VERSION 2
+#define FILTER_FILE_DATA_OFFSET 4096
 
 /*
-Function Description: calculates the optimum bit array 'm' based on the number
-of unique words 'n' and the desired false positive rate 'max_fp_rate'. It will
-iteratively calculate the false positive rate unit it falls below the desired
-maximum fp '0.05'.
+Function Description: calculates the optimum bit array size 'm' for 'n' unique words and the
+desired false positive rate 'max_fp_rate' in closed form, m = -n ln(p) / (ln 2)^2, rounded up
+to a power of two (and at least one 64-bit word) so that a probe index can be reduced with a
+mask instead of a modulo. Rounding up only lowers the false positive rate, because
+calc_optimum_hash_functions then picks k for the larger m.
 */
-int calc_optimum_bitArraySize(int n, double max_fp_rate) {
-    int k = NUM_HASH_FUNCTIONS;
-    double m = 1.0;
-    double current_false_positive_rate = 1.0;
+uint64_t calc_optimum_bitArraySize(int n, double max_fp_rate) {
+    double optimum = -n * log(max_fp_rate) / (log(2) * log(2));
+    uint64_t m = 64;
+    while ((double)m < optimum) {
+        m <<= 1;
+    }
+    return m;
+}
+
+/*
+Function Description: the number of hash functions that minimises the false positive rate of
+a filter of 'm' bits holding 'n' words, k = (m / n) ln 2, rounded and kept within
+1..MAX_HASH_FUNCTIONS.
+*/
+int calc_optimum_hash_functions(int n, uint64_t m) {
+    if (n == 0) {
+        return 1;
+    }
+    long k = lround((double)m / n * log(2));
+    if (k < 1) {
+        return 1;
+    }
+    return k > MAX_HASH_FUNCTIONS ? MAX_HASH_FUNCTIONS : (int)k;
+}
+
+/*
+Function Description: 64-bit MurmurHash64A of the 'len' bytes at 'word'. Every word is
+hashed exactly once with this function, when it is read into the string set; the stored
+hash then drives both the set's slot table and the k bloom filter probes. Unlike summing
+the ASCII values, every byte and its position affect all 64 output bits, so anagrams do not
+collide.
+*/
+uint64_t string_hash(const char *word, size_t len) {
+    const uint64_t mul = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t hash = HASH_SEED ^ (len * mul);
+    const unsigned char *data = (const unsigned char *)word;
+    const unsigned char *end = data + (len & ~(size_t)7);
+
+    while (data != end) {
+        uint64_t block;
+        memcpy(&block, data, sizeof(block));
+        block *= mul;
+        block ^= block >> r;
+        block *= mul;
+        hash ^= block;
+        hash *= mul;
+        data += 8;
+    }
+    switch (len & 7) {
+        case 7: hash ^= (uint64_t)data[6] << 48; // fall through
+        case 6: hash ^= (uint64_t)data[5] << 40; // fall through
+        case 5: hash ^= (uint64_t)data[4] << 32; // fall through
+        case 4: hash ^= (uint64_t)data[3] << 24; // fall through
+        case 3: hash ^= (uint64_t)data[2] << 16; // fall through
+        case 2: hash ^= (uint64_t)data[1] << 8;  // fall through
+        case 1: hash ^= (uint64_t)data[0];
+                hash *= mul;
+    }
+    hash ^= hash >> r;
+    hash *= mul;
+    hash ^= hash >> r;
+    return hash;
+}
+
+/*
+Function Description: derives the j-th of k bit indices from a word's 64-bit hash using
+double hashing, g_j = h1 + j * h2 (mod m). h1 is the hash itself and h2 is a remix of it
+forced to be odd, so the k probes of one word land on k different bits instead of the same
+bit k times. m is a power of two, so the modulo is the mask m - 1.
+*/
+uint64_t bloom_second_hash(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash | 1;
+}
+
+uint64_t bloom_probe_index(uint64_t h1, uint64_t h2, int j, uint64_t mask) {
+    return (h1 + (uint64_t)j * h2) & mask;
+}
+
+/*
+Struct Description: the instrumentation of a run (-j). Every OpenMP thread position that does
+any work gets its own 'thread_stats' slot, 64-byte aligned so that threads never share a
+cache line, and adds to it without synchronization: the time it spent in each phase, and
+counts of tokens read, unique words found (in the thread's own set), filter probes, probes
+that found their bit already set (on insert) or set (on query), and input bytes. With -H the
+slot also sums the instructions and cache misses its thread executed inside the timed phases,
+read from two perf_event_open hardware counters. Phases are timed once per batch of work,
+never per word, and probes are only counted while instrumentation is on (see
+bloom_insert_counted), so a normal run pays nothing but a NULL check per batch.
+
+The slot of a thread is its thread number in the one active team it belongs to (see
+thread_stats), not its OS thread: libgomp may run the nested regions of split mode on fresh
+OS threads, and they should still add up to one row per thread of the team.
+*/
+enum phase {
+    PHASE_TOKENIZE,
+    PHASE_DEDUP,
+    PHASE_SIZING,
+    PHASE_INSERT,
+    PHASE_QUERY,
+    NUM_PHASES
+};
+
+const char *phase_names[NUM_PHASES] = {"tokenize", "dedup", "sizing", "insert", "query"};
+
+enum counter {
+    COUNT_TOKENS,
+    COUNT_UNIQUE_WORDS,
+    COUNT_PROBES,
+    COUNT_BIT_HITS,
+    COUNT_BYTES_READ,
+    NUM_COUNTERS
+};
+
+const char *counter_names[NUM_COUNTERS] = {"tokens", "unique_words", "probes", "bit_set_hits", "bytes_read"};
+
+enum hardware_counter {
+    HW_INSTRUCTIONS,
+    HW_CACHE_MISSES,
+    NUM_HW_COUNTERS
+};
+
+const char *hardware_counter_names[NUM_HW_COUNTERS] = {"instructions", "cache_misses"};
+
+struct thread_stats {
+    double time[NUM_PHASES];
+    uint64_t counts[NUM_COUNTERS];
+    uint64_t hardware[NUM_HW_COUNTERS];
+    int hardware_ok[NUM_HW_COUNTERS];
+    int used;
+} __attribute__((aligned(64)));
+
+struct thread_stats *instrumentation = NULL;
+int instrument_hardware = 0;
+
+/*
+the hardware counters belong to OS threads, so their file descriptors and the values read at
+the start of the current phase are threadprivate; they are opened on a thread's first phase
+and stay open until the process exits.
+*/
+int hardware_opened = 0;
+int hardware_fds[NUM_HW_COUNTERS];
+uint64_t hardware_start[NUM_HW_COUNTERS];
+#pragma omp threadprivate(hardware_opened, hardware_fds, hardware_start)
+
+/*
+Function Description: opens the hardware counters of the calling thread. A counter that
+cannot be opened (no PMU, or perf_event_paranoid forbids it) keeps the fd -1 and is left out
+of the report.
+*/
+void open_hardware_counters(void) {
+    static const uint64_t configs[NUM_HW_COUNTERS] = {PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES};
+    for (int c = 0; c < NUM_HW_COUNTERS; c++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[c];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        hardware_fds[c] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    hardware_opened = 1;
+}
+
+/*
+Function Description: returns the instrumentation slot of the calling thread, or NULL if
+instrumentation is off. The slot is the thread's number in the outermost active parallel
+region of more than one thread enclosing it, or 0 outside of any. With -s the loop over
+the files runs as a team of one and the read, insert and query regions of each file nest
+inside it, so those inner teams supply the thread number; otherwise the inner regions get
+one thread each (nesting is never enabled) and the number in the file loop's team is
+used. Either way two threads running at the same time never share a slot.
+*/
+struct thread_stats *thread_stats(void) {
+    if (instrumentation == NULL) {
+        return NULL;
+    }
+    int slot = 0;
+    for (int level = 1; level <= omp_get_level(); level++) {
+        if (omp_get_team_size(level) > 1) {
+            slot = omp_get_ancestor_thread_num(level);
+            break;
+        }
+    }
+    struct thread_stats *stats = &instrumentation[slot < MAX_INSTRUMENTED_THREADS ? slot : MAX_INSTRUMENTED_THREADS - 1];
+    stats->used = 1;
+    return stats;
+}
+
+/*
+Function Description: instrument_start returns the start time of a phase (and, with -H,
+records the hardware counters of the calling thread), instrument_end adds the time and the
+counter deltas since then to 'phase' of 'stats'. Both do nothing for a NULL 'stats'.
+*/
+double instrument_start(const struct thread_stats *stats) {
+    if (stats == NULL) {
+        return 0.0;
+    }
+    if (instrument_hardware) {
+        if (!hardware_opened) {
+            open_hardware_counters();
+        }
+        for (int c = 0; c < NUM_HW_COUNTERS; c++) {
+            if (hardware_fds[c] < 0 || read(hardware_fds[c], &hardware_start[c], sizeof(uint64_t)) != sizeof(uint64_t)) {
+                hardware_start[c] = UINT64_MAX;
+            }
+        }
+    }
+    return omp_get_wtime();
+}
+
+void instrument_end(struct thread_stats *stats, enum phase phase, double start_time) {
+    if (stats == NULL) {
+        return;
+    }
+    stats->time[phase] += omp_get_wtime() - start_time;
+    if (instrument_hardware) {
+        for (int c = 0; c < NUM_HW_COUNTERS; c++) {
+            uint64_t value;
+            if (hardware_start[c] != UINT64_MAX && read(hardware_fds[c], &value, sizeof(value)) == sizeof(value)) {
+                stats->hardware[c] += value - hardware_start[c];
+                stats->hardware_ok[c] = 1;
+            }
+        }
+    }
+}
+
+void instrument_count(struct thread_stats *stats, enum counter counter, uint64_t amount) {
+    if (stats != NULL) {
+        stats->counts[counter] += amount;
+    }
+}
+
+/*
+Function Description: turns instrumentation on for the rest of the run; 'hardware' also
+reads the hardware counters of every thread. Returns 1 on success, 0 if memory allocation
+has failed.
+*/
+int instrumentation_init(int hardware) {
+    instrumentation = (struct thread_stats *)aligned_alloc(64, MAX_INSTRUMENTED_THREADS * sizeof(struct thread_stats));
+    if (instrumentation == NULL) {
+        return 0;
+    }
+    memset(instrumentation, 0, MAX_INSTRUMENTED_THREADS * sizeof(struct thread_stats));
+    instrument_hardware = hardware;
+    return 1;
+}
+
+/*
+Function Description: writes the instrumentation of the run to 'path' ("-" for stdout) as
+JSON: one object per thread with its phase times, counters and hardware counters, the
+totals, and the load imbalance of every phase and of the threads' total busy time. The
+imbalance is the busiest thread's time divided by the mean over the threads that did any
+work, so 1.0 is perfectly balanced and N means one of N threads did everything. Returns 1 on
+success, 0 if the file could not be written.
+*/
+int write_instrumentation_report(const char *path, double wall_time) {
+    FILE *file = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (file == NULL) {
+        perror("There's an error creating the report file");
+        return 0;
+    }
+    int num_threads = 0;
+    for (int t = 0; t < MAX_INSTRUMENTED_THREADS; t++) {
+        num_threads = instrumentation[t].used ? t + 1 : num_threads;
+    }
+    double phase_total[NUM_PHASES] = {0}, phase_max[NUM_PHASES] = {0};
+    uint64_t counter_total[NUM_COUNTERS] = {0};
+    uint64_t hardware_total[NUM_HW_COUNTERS] = {0};
+    int hardware_ok[NUM_HW_COUNTERS] = {0};
+    double busy_total = 0.0, busy_max = 0.0;
+    int busy_active = 0;
+
+    fprintf(file, "{\n  \"wall_seconds\": %f,\n  \"max_threads\": %d,\n  \"threads\": [\n", wall_time, omp_get_max_threads());
+    for (int t = 0; t < num_threads; t++) {
+        struct thread_stats *stats = &instrumentation[t];
+        double busy = 0.0;
+        fprintf(file, "    {\"thread\": %d", t);
+        for (int p = 0; p < NUM_PHASES; p++) {
+            fprintf(file, ", \"%s_seconds\": %f", phase_names[p], stats->time[p]);
+            phase_total[p] += stats->time[p];
+            phase_max[p] = stats->time[p] > phase_max[p] ? stats->time[p] : phase_max[p];
+            busy += stats->time[p];
+        }
+        fprintf(file, ", \"busy_seconds\": %f", busy);
+        busy_total += busy;
+        busy_active += busy > 0.0;
+        busy_max = busy > busy_max ? busy : busy_max;
+        for (int c = 0; c < NUM_COUNTERS; c++) {
+            fprintf(file, ", \"%s\": %llu", counter_names[c], (unsigned long long)stats->counts[c]);
+            counter_total[c] += stats->counts[c];
+        }
+        for (int c = 0; c < NUM_HW_COUNTERS; c++) {
+            if (stats->hardware_ok[c]) {
+                fprintf(file, ", \"%s\": %llu", hardware_counter_names[c], (unsigned long long)stats->hardware[c]);
+                hardware_total[c] += stats->hardware[c];
+                hardware_ok[c] = 1;
+            }
+        }
+        fprintf(file, "}%s\n", t + 1 < num_threads ? "," : "");
+    }
+    fprintf(file, "  ],\n  \"totals\": {");
+    for (int p = 0; p < NUM_PHASES; p++) {
+        fprintf(file, "%s\"%s_seconds\": %f", p > 0 ? ", " : "", phase_names[p], phase_total[p]);
+    }
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        fprintf(file, ", \"%s\": %llu", counter_names[c], (unsigned long long)counter_total[c]);
+    }
+    for (int c = 0; c < NUM_HW_COUNTERS; c++) {
+        if (hardware_ok[c]) {
+            fprintf(file, ", \"%s\": %llu", hardware_counter_names[c], (unsigned long long)hardware_total[c]);
+        }
+    }
+    fprintf(file, "},\n  \"imbalance\": {");
+    for (int p = 0; p < NUM_PHASES; p++) {
+        int active = 0;
+        for (int t = 0; t < num_threads; t++) {
+            active += instrumentation[t].time[p] > 0.0;
+        }
+        fprintf(file, "\"%s\": %f, ", phase_names[p], phase_total[p] > 0.0 ? phase_max[p] * active / phase_total[p] : 1.0);
+    }
+    fprintf(file, "\"busy\": %f}\n}\n", busy_total > 0.0 ? busy_max * busy_active / busy_total : 1.0);
+    if (file != stdout && fclose(file) != 0) {
+        perror("There's an error writing the report file");
+        return 0;
+    }
+    return 1;
+}
+
+/*
+Struct Description: a hash set of unique words that owns its strings. The words are copied
+back to back (NUL-terminated) into one 'arena' buffer, and 'entries' holds, for every
+unique word in insertion order, its offset into the arena, its length and its hash.
+'slots' is an open addressing (linear probing) table of entry indices plus one, where zero
+marks an empty slot. All three buffers grow geometrically, so inserting a word costs O(1)
+amortized and freeing the whole set is a handful of free() calls instead of one per word.
+*/
+struct string_entry {
+    uint64_t hash;
+    size_t offset;
+    size_t len;
+};
+
+struct string_set {
+    char *arena;
+    size_t arena_used;
+    size_t arena_cap;
+    struct string_entry *entries;
+    int count;
+    int entries_cap;
+    uint32_t *slots;
+    size_t num_slots; // always a power of two
+};
+
+void string_set_init(struct string_set *set) {
+    memset(set, 0, sizeof(*set));
+}
+
+void string_set_free(struct string_set *set) {
+    free(set->arena);
+    free(set->entries);
+    free(set->slots);
+    memset(set, 0, sizeof(*set));
+}
+
+/*
+Function Description: returns the i-th unique word of the set as a NUL-terminated string.
+*/
+const char *string_set_word(const struct string_set *set, int i) {
+    return set->arena + set->entries[i].offset;
+}
+
+/*
+Function Description: doubles the slot table and re-inserts every entry using its stored
+hash, so the words themselves are never touched. Returns 1 on success, 0 on failure.
+*/
+int string_set_grow_slots(struct string_set *set) {
+    size_t num_slots = set->num_slots ? set->num_slots * 2 : 1024;
+    uint32_t *slots = (uint32_t *)calloc(num_slots, sizeof(uint32_t));
+    if (slots == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < set->count; i++) {
+        size_t slot = set->entries[i].hash & (num_slots - 1);
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & (num_slots - 1);
+        }
+        slots[slot] = (uint32_t)i + 1;
+    }
+    free(set->slots);
+    set->slots = slots;
+    set->num_slots = num_slots;
+    return 1;
+}
+
+/*
+Function Description: walks the probe sequence of 'hash' and returns the slot that holds the
+word equal to the 'len' bytes at 'word', or the empty slot where it would be inserted.
+*/
+size_t string_set_find_slot(const struct string_set *set, const char *word, size_t len, uint64_t hash) {
+    size_t slot = hash & (set->num_slots - 1);
+    while (set->slots[slot] != 0) {
+        const struct string_entry *entry = &set->entries[set->slots[slot] - 1];
+        if (entry->hash == hash && entry->len == len &&
+            memcmp(set->arena + entry->offset, word, len) == 0) {
+            break;
+        }
+        slot = (slot + 1) & (set->num_slots - 1);
+    }
+    return slot;
+}
+
+/*
+Function Description: returns 1 if the 'len' bytes at 'word' are one of the set's words.
+*/
+int string_set_contains(const struct string_set *set, const char *word, size_t len) {
+    if (set->num_slots == 0) {
+        return 0;
+    }
+    return set->slots[string_set_find_slot(set, word, len, string_hash(word, len))] != 0;
+}
+
+/*
+Function Description: adds the 'len' bytes at 'word' to the set unless an equal word is
+already in it. The slot table is kept at most half full, so a probe sequence is short.
+Returns 1 if the word was new, 0 if it was a duplicate and -1 if memory allocation failed.
+string_set_insert_hashed takes the word's string_hash when the caller already has it, e.g.
+when merging one set into another.
+*/
+int string_set_insert_hashed(struct string_set *set, const char *word, size_t len, uint64_t hash) {
+    if ((size_t)(set->count + 1) * 2 > set->num_slots && !string_set_grow_slots(set)) {
+        return -1;
+    }
+    size_t slot = string_set_find_slot(set, word, len, hash);
+    if (set->slots[slot] != 0) {
+        return 0;
+    }
+
+    if (set->count == set->entries_cap) {
+        int entries_cap = set->entries_cap ? set->entries_cap * 2 : 1024;
+        struct string_entry *entries = (struct string_entry *)realloc(set->entries, entries_cap * sizeof(struct string_entry));
+        if (entries == NULL) {
+            return -1;
+        }
+        set->entries = entries;
+        set->entries_cap = entries_cap;
+    }
+    if (set->arena_used + len + 1 > set->arena_cap) {
+        size_t arena_cap = set->arena_cap ? set->arena_cap * 2 : 16384;
+        while (set->arena_used + len + 1 > arena_cap) {
+            arena_cap *= 2;
+        }
+        char *arena = (char *)realloc(set->arena, arena_cap);
+        if (arena == NULL) {
+            return -1;
+        }
+        set->arena = arena;
+        set->arena_cap = arena_cap;
+    }
+
+    struct string_entry *entry = &set->entries[set->count];
+    entry->hash = hash;
+    entry->offset = set->arena_used;
+    entry->len = len;
+    memcpy(set->arena + set->arena_used, word, len);
+    set->arena[set->arena_used + len] = '\0';
+    set->arena_used += len + 1;
+    set->slots[slot] = (uint32_t)set->count + 1;
+    set->count++;
+    return 1;
+}
+
+int string_set_insert(struct string_set *set, const char *word, size_t len) {
+    return string_set_insert_hashed(set, word, len, string_hash(word, len));
+}
+
+/*
+Struct Description: a read-only memory mapping of a whole input file. Tokens are handed on
+as (pointer, length) views into 'data', so nothing is copied until the string set keeps a
+new unique word. An empty file has size 0 and no mapping.
+*/
+struct mapped_file {
+    const char *data;
+    size_t size;
+};
+
+/*
+Function Description: maps the file 'filename' into memory for sequential reading. Returns 1
+on success, 0 if the file could not be opened or mapped.
+*/
+int map_file(const char *filename, struct mapped_file *file) {
+    file->data = NULL;
+    file->size = 0;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        close(fd);
+        return 0;
+    }
+    file->size = (size_t)file_stat.st_size;
+    if (file->size > 0) {
+        void *data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return 0;
+        }
+        madvise(data, file->size, MADV_SEQUENTIAL);
+        file->data = (const char *)data;
+    }
+    close(fd); // the mapping stays valid after the descriptor is closed
+    return 1;
+}
+
+void unmap_file(struct mapped_file *file) {
+    if (file->data != NULL) {
+        munmap((void *)file->data, file->size);
+    }
+    file->data = NULL;
+    file->size = 0;
+}
+
+/*
+Function Description: classifies the 64 bytes at 'p' and returns a bit mask with bit i set
+if p[i] is whitespace in the sense of fscanf's "%s" (space, \t, \n, \v, \f or \r). A byte c
+is whitespace if c == ' ' or c - 9 <= 4 as an unsigned byte. With AVX2 this is two 32-byte
+compares, with SSE2 four 16-byte compares, and a plain loop on other targets.
+*/
+uint64_t whitespace_mask64(const char *p) {
+#if defined(__AVX2__)
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i four = _mm256_set1_epi8(4);
+    uint64_t mask = 0;
+    for (int i = 0; i < 64; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i shifted = _mm256_sub_epi8(bytes, tab);
+        __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, four), shifted);
+        __m256i blank = _mm256_cmpeq_epi8(bytes, space);
+        mask |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_or_si256(control, blank)) << i;
+    }
+    return mask;
+#elif defined(__SSE2__)
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i four = _mm_set1_epi8(4);
+    uint64_t mask = 0;
+    for (int i = 0; i < 64; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i shifted = _mm_sub_epi8(bytes, tab);
+        __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, four), shifted);
+        __m128i blank = _mm_cmpeq_epi8(bytes, space);
+        mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_or_si128(control, blank)) << i;
+    }
+    return mask;
+#else
+    uint64_t mask = 0;
+    for (int i = 0; i < 64; i++) {
+        unsigned char c = (unsigned char)p[i];
+        if (c == ' ' || (unsigned char)(c - '\t') <= 4) {
+            mask |= 1ULL << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+/*
+Struct Description: an iterator over the whitespace separated tokens of a byte buffer. The
+buffer is classified 64 bytes at a time with whitespace_mask64 and the mask of the current
+block is cached, so every byte is classified once, and token boundaries are then found with
+count-trailing-zeros instead of testing one byte at a time.
+*/
+struct token_scanner {
+    const char *data;
+    size_t size;
+    size_t pos;
+    size_t block;       // offset of the 64-byte block 'mask' describes
+    uint64_t mask;      // whitespace bits of that block
+    int have_block;
+};
+
+void token_scanner_init(struct token_scanner *scanner, const char *data, size_t size, size_t pos) {
+    scanner->data = data;
+    scanner->size = size;
+    scanner->pos = pos;
+    scanner->have_block = 0;
+}
+
+/*
+Function Description: advances the scanner to the first position at or after its current one
+whose byte is whitespace ('want_space' = 1) or not whitespace ('want_space' = 0). Returns 0
+if the end of the buffer is reached first. The last, partial block is classified byte by
+byte so that nothing past the end of the buffer is ever loaded.
+*/
+int token_scanner_seek(struct token_scanner *scanner, int want_space) {
+    while (scanner->pos < scanner->size) {
+        size_t block = scanner->pos & ~(size_t)63;
+        size_t valid = scanner->size - block < 64 ? scanner->size - block : 64;
+        if (!scanner->have_block || scanner->block != block) {
+            if (valid == 64) {
+                scanner->mask = whitespace_mask64(scanner->data + block);
+            } else {
+                scanner->mask = 0;
+                for (size_t i = 0; i < valid; i++) {
+                    unsigned char c = (unsigned char)scanner->data[block + i];
+                    if (c == ' ' || (unsigned char)(c - '\t') <= 4) {
+                        scanner->mask |= 1ULL << i;
+                    }
+                }
+            }
+            scanner->block = block;
+            scanner->have_block = 1;
+        }
+        uint64_t bits = want_space ? scanner->mask : ~scanner->mask;
+        bits &= ~0ULL << (scanner->pos & 63);
+        if (valid < 64) {
+            bits &= (1ULL << valid) - 1;
+        }
+        if (bits != 0) {
+            scanner->pos = block + (size_t)__builtin_ctzll(bits);
+            return 1;
+        }
+        scanner->pos = block + valid;
+    }
+    return 0;
+}
+
+/*
+Function Description: returns the next token as a view ('token', 'len') into the scanned
+buffer, or 0 once there are no tokens left.
+*/
+int token_scanner_next(struct token_scanner *scanner, const char **token, size_t *len) {
+    if (!token_scanner_seek(scanner, 0)) {
+        return 0;
+    }
+    size_t start = scanner->pos;
+    token_scanner_seek(scanner, 1); // stops at the end of the buffer if the token runs to it
+    *token = scanner->data + start;
+    *len = scanner->pos - start;
+    return 1;
+}
+
+/*
+Function Description: tokenizes the tokens that start in the byte range ['start', 'end') of
+the mapped 'file' and adds every one of them to 'set', counting them in 'total_strings'.
+If the byte before 'start' is not whitespace, the range begins in the middle of a token
+that belongs to the previous range, so that token is skipped, and the range's own last
+token is read to its end even if it crosses 'end'. Every token of the file is therefore seen
+by exactly one range. Tokens are cut out TOKENIZE_BATCH at a time and then inserted, so the
+tokenize and dedup phases can be timed per batch for the instrumentation. Returns 1 on
+success, 0 if memory allocation has failed.
+*/
+int read_strings_from_range(const struct mapped_file *file, size_t start, size_t end, struct string_set *set, int *total_strings) {
+    struct thread_stats *stats = thread_stats();
+    struct token_scanner scanner;
+    token_scanner_init(&scanner, file->data, file->size, start);
+    if (start > 0 && !isspace((unsigned char)file->data[start - 1])) {
+        token_scanner_seek(&scanner, 1);
+    }
+    const char *tokens[TOKENIZE_BATCH];
+    size_t lengths[TOKENIZE_BATCH];
+    int done = 0;
+    uint64_t new_words = 0;
+    while (!done) {
+        double start_time = instrument_start(stats);
+        int count = 0;
+        while (count < TOKENIZE_BATCH) {
+            if (scanner.pos >= end || !token_scanner_next(&scanner, &tokens[count], &lengths[count]) ||
+                tokens[count] - file->data >= (ptrdiff_t)end) {
+                done = 1;
+                break;
+            }
+            count++;
+        }
+        instrument_end(stats, PHASE_TOKENIZE, start_time);
+
+        start_time = instrument_start(stats);
+        for (int t = 0; t < count; t++) {
+            // the set copies the token into its arena only if it has not been seen before
+            int inserted = string_set_insert(set, tokens[t], lengths[t]);
+            if (inserted < 0) {
+                return 0;
+            }
+            new_words += inserted;
+        }
+        instrument_end(stats, PHASE_DEDUP, start_time);
+        *total_strings += count;
+        instrument_count(stats, COUNT_TOKENS, count);
+    }
+    instrument_count(stats, COUNT_UNIQUE_WORDS, new_words);
+    instrument_count(stats, COUNT_BYTES_READ, end - start);
+    return 1;
+}
+
+/*
+Function Description: Reads strings from text file specified by a 'filename' and stores 
+the unique words in the string set 'set'. It also keeps track of the total number of strings
+read across the file 'total_strings', the size of the file in 'bytes_read', and the total
+wall-clock time taken for reading and counting the unique words. The file is memory mapped and split into tokens by a token_scanner, and every
+token is offered to string_set_insert as a view into the mapping, which hashes it and only
+copies it into the set's arena if it has not been seen before. There is no per-token stdio
+call and no fixed size buffer, so tokens of any length are read correctly. The number of
+unique words is available afterwards as set->count.
+*/
+int read_strings_from_file(const char *filename, struct string_set *set, int *total_strings, size_t *bytes_read, double *local_read_time) {
+    double start_time = omp_get_wtime();
+
+    struct mapped_file file;
+    if (!map_file(filename, &file)) {
+        perror("There's an error opening this text file");
+        return 0;
+    }
+    string_set_init(set);
+    if (!read_strings_from_range(&file, 0, file.size, set, total_strings)) {
+        perror("Memory allocation has failed");
+        string_set_free(set);
+        unmap_file(&file);
+        return 0;
+    }
+    *bytes_read += file.size;
+    unmap_file(&file);
+
+    *local_read_time = omp_get_wtime() - start_time; // Store the local read time
+    return 1;
+}
+
+/*
+Function Description: the intra-file parallel version of read_strings_from_file. Instead of
+one thread reading the whole file, the mapped file is cut into one byte range per OpenMP
+thread, and each thread tokenizes and deduplicates its own range into a private string set
+(see read_strings_from_range). The per-thread sets are then merged into 'set' using the
+hashes they already stored, so no word is hashed twice. Because the expensive part, touching
+every token, is spread over all threads, a single large file is read as fast as the cores
+allow.
+*/
+int read_strings_from_file_split(const char *filename, struct string_set *set, int *total_strings, size_t *bytes_read, double *local_read_time) {
+    double start_time = omp_get_wtime();
+
+    struct mapped_file file;
+    if (!map_file(filename, &file)) {
+        perror("There's an error opening this text file");
+        return 0;
+    }
+
+    int num_threads = omp_get_max_threads();
+    struct string_set *local_sets = (struct string_set *)malloc(num_threads * sizeof(struct string_set));
+    if (local_sets == NULL) {
+        perror("Memory allocation has failed");
+        unmap_file(&file);
+        return 0;
+    }
+    int strings_read = 0;
+    int failed = 0;
+
+    #pragma omp parallel num_threads(num_threads) reduction(+:strings_read) reduction(||:failed)
+    {
+        int t = omp_get_thread_num();
+        int team_size = omp_get_num_threads();
+        size_t start = file.size * t / team_size;
+        size_t end = file.size * (t + 1) / team_size;
+        string_set_init(&local_sets[t]);
+        if (start < end && !read_strings_from_range(&file, start, end, &local_sets[t], &strings_read)) {
+            failed = 1;
+        }
+    }
+    *bytes_read += file.size;
+    unmap_file(&file);
+
+    string_set_init(set);
+    for (int t = 0; t < num_threads; t++) {
+        const struct string_set *local = &local_sets[t];
+        for (int i = 0; i < local->count && !failed; i++) {
+            const struct string_entry *entry = &local->entries[i];
+            if (string_set_insert_hashed(set, local->arena + entry->offset, entry->len, entry->hash) < 0) {
+                failed = 1;
+            }
+        }
+        string_set_free(&local_sets[t]);
+    }
+    free(local_sets);
+    if (failed) {
+        perror("Memory allocation has failed");
+        string_set_free(set);
+        return 0;
+    }
+    *total_strings += strings_read;
+
+    *local_read_time = omp_get_wtime() - start_time;
+    return 1;
+}
+
+/*
+Struct Description: the bloom filter's bit array, packed 64 bits to a uint64_t word and
+addressed by bit index: bit i lives in words[i / 64] under the mask 1 << (i % 64). Compared
+to one int per bit this takes 32 times less memory, so far larger filters stay in cache.
+
+The filter comes in two layouts ('kind'):
+- FILTER_CLASSIC spreads the k bits of a word over the whole array, one cache miss each.
+- FILTER_BLOCKED splits the array into 512-bit (64-byte, one cache line) blocks. One hash
+  picks the block and all k bits of the word are set or tested inside it, so an insert or a
+  query touches a single cache line. Bits cluster per block, so for the same m the false
+  positive rate is a little higher; calc_blocked_bitArraySize sizes for that.
+- FILTER_COUNTING probes like FILTER_CLASSIC, but every position is a 4-bit counter instead
+  of a bit, 16 to a uint64_t word, so words can be removed again (see bloom_remove). A
+  counter saturates at COUNTER_MAX and then stays there: an insert can no longer be counted
+  and a removal can no longer know how many words still use it, so leaving it set is the only
+  choice that never causes a false negative. counting_saturated_counters reports how many
+  counters have overflowed this way. At 4 bits per position the filter takes m / 2 bytes, an
+  eighth of one int per position.
+The words are allocated 64-byte aligned so that a block never straddles two cache lines.
+
+'m' is always a power of two, so a bit index (or block index) is reduced with 'mask' instead
+of a modulo. 'k' is chosen per filter, and 'insert' / 'query' point to probe functions
+specialized for that k (see bloom_filter_set_probes).
+*/
+enum filter_kind {
+    FILTER_CLASSIC,
+    FILTER_BLOCKED,
+    FILTER_COUNTING,
+    NUM_FILTER_KINDS
+};
+
+const char *filter_kind_names[NUM_FILTER_KINDS] = {"classic", "blocked", "counting"};
+
+struct bloom_filter {
+    uint64_t *words;
+    size_t num_words;
+    uint64_t m;
+    uint64_t mask;         // m - 1 for a classic or counting filter, m / BLOCK_BITS - 1 for a blocked one
+    int k;
+    enum filter_kind kind;
+    void (*insert)(struct bloom_filter *filter, uint64_t hash);
+    int (*query)(const struct bloom_filter *filter, uint64_t hash);
+    void *mapping;         // set when 'words' points into a filter file mapped by load_filter
+    size_t mapping_size;
+};
+
+/*
+Function Description: the false positive rate of a classic filter of 'm' bits holding 'n'
+words with 'k' hash functions.
+*/
+double classic_false_positive_rate(int n, uint64_t m, int k) {
+    return pow(1 - pow(1 - (1.0 / m), (double)k * n), k);
+}
+
+/*
+Function Description: the false positive rate of a blocked filter of 'm' bits holding 'n'
+words with 'k' bits per word. The number of words that land in one block is Poisson
+distributed with mean n / (m / BLOCK_BITS), and a block holding i words behaves like a
+classic filter of BLOCK_BITS bits holding i words, so the rate is the Poisson-weighted sum of
+classic rates. Terms further than 12 standard deviations from the mean are negligible.
+*/
+double blocked_false_positive_rate(int n, uint64_t m, int k) {
+    if (n == 0) {
+        return 0.0;
+    }
+    double mean = (double)n * BLOCK_BITS / m;
+    double spread = 12.0 * sqrt(mean) + 20.0;
+    int first = mean > spread ? (int)(mean - spread) : 0;
+    int last = (int)(mean + spread);
+    double rate = 0.0;
+    for (int i = first; i <= last; i++) {
+        double weight = exp(-mean + i * log(mean) - lgamma(i + 1.0));
+        rate += weight * pow(1 - pow(1 - (1.0 / BLOCK_BITS), (double)k * i), k);
+    }
+    return rate;
+}
+
+/*
+Function Description: calculates the size of a blocked filter for 'n' words. It starts from
+the classic optimum (already a power of two, at least one block) and doubles it while the
+blocked false positive rate, with k chosen for that size, is above 'max_fp_rate'. Because
+doubling halves the load per block, this rarely takes more than one step.
+*/
+uint64_t calc_blocked_bitArraySize(int n, double max_fp_rate) {
+    uint64_t m = calc_optimum_bitArraySize(n, max_fp_rate);
+    if (m < BLOCK_BITS) {
+        m = BLOCK_BITS;
+    }
+    while (blocked_false_positive_rate(n, m, calc_optimum_hash_functions(n, m)) > max_fp_rate) {
+        m <<= 1;
+    }
+    return m;
+}
+
+/*
+Function Description: the probe loops of the bit layouts, written once for a run-time 'k'. They
+are always inlined, so every caller that passes a constant k gets a copy with the loop fully
+unrolled; DEFINE_PROBE_FUNCTIONS below instantiates those copies for k = 1..8.
+
+A classic probe index is g_j = (h1 + j * h2) & mask. A blocked filter picks its block with
+the hash's low bits and takes the k bit positions inside the block from consecutive 9-bit
+fields of the second hash, which is remixed after every 7 fields (its lowest bit is dropped
+because bloom_second_hash forces it to 1). Every bit is set with an atomic fetch-or on its
+64-bit word, so several OpenMP threads can insert into the same filter without locks. A
+blocked query compares the word's 512-bit mask against its whole block at once: with AVX2
+that is two 256-bit 'testc' instructions, otherwise a branch-free loop the compiler
+vectorizes.
+*/
+static inline __attribute__((always_inline)) void classic_insert_k(struct bloom_filter *filter, uint64_t hash, int k) {
+    uint64_t h2 = bloom_second_hash(hash);
+    for (int j = 0; j < k; j++) {
+        uint64_t index = bloom_probe_index(hash, h2, j, filter->mask);
+        #pragma omp atomic
+        filter->words[index >> 6] |= 1ULL << (index & 63);
+    }
+}
+
+static inline __attribute__((always_inline)) int classic_query_k(const struct bloom_filter *filter, uint64_t hash, int k) {
+    uint64_t h2 = bloom_second_hash(hash);
+    for (int j = 0; j < k; j++) {
+        uint64_t index = bloom_probe_index(hash, h2, j, filter->mask);
+        if ((filter->words[index >> 6] & (1ULL << (index & 63))) == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static inline __attribute__((always_inline)) int blocked_bit_position(uint64_t *bits, int j) {
+    if (j % 7 == 0) {
+        *bits = bloom_second_hash(*bits + j) >> 1;
+    }
+    int position = (int)(*bits & (BLOCK_BITS - 1));
+    *bits >>= 9;
+    return position;
+}
+
+static inline __attribute__((always_inline)) uint64_t *blocked_block(const struct bloom_filter *filter, uint64_t hash) {
+    return filter->words + (hash & filter->mask) * 8;
+}
+
+static inline __attribute__((always_inline)) void blocked_insert_k(struct bloom_filter *filter, uint64_t hash, int k) {
+    uint64_t *block = blocked_block(filter, hash);
+    uint64_t bits = hash;
+    for (int j = 0; j < k; j++) {
+        int position = blocked_bit_position(&bits, j);
+        #pragma omp atomic
+        block[position >> 6] |= 1ULL << (position & 63);
+    }
+}
+
+static inline __attribute__((always_inline)) int blocked_query_k(const struct bloom_filter *filter, uint64_t hash, int k) {
+    const uint64_t *block = blocked_block(filter, hash);
+    uint64_t mask[8] = {0};
+    uint64_t bits = hash;
+    for (int j = 0; j < k; j++) {
+        int position = blocked_bit_position(&bits, j);
+        mask[position >> 6] |= 1ULL << (position & 63);
+    }
+#if defined(__AVX2__)
+    __m256i low = _mm256_load_si256((const __m256i *)block);
+    __m256i high = _mm256_load_si256((const __m256i *)(block + 4));
+    return _mm256_testc_si256(low, _mm256_loadu_si256((const __m256i *)mask)) &
+           _mm256_testc_si256(high, _mm256_loadu_si256((const __m256i *)(mask + 4)));
+#else
+    uint64_t missing = 0;
+    for (int w = 0; w < 8; w++) {
+        missing |= mask[w] & ~block[w];
+    }
+    return missing == 0;
+#endif
+}
+
+/*
+Function Description: adds 'delta' (+1 or -1) to the 4-bit counter at bit 'shift' of 'word'
+with a compare-and-swap loop, so concurrent updates of the other 15 counters in the same word
+are never lost. A saturated counter (COUNTER_MAX) is left alone, and so is a zero counter
+that would be decremented. Returns 1 if the counter was changed.
+*/
+static inline __attribute__((always_inline)) int counter_add(uint64_t *word, int shift, int delta) {
+    uint64_t old = __atomic_load_n(word, __ATOMIC_RELAXED);
+    for (;;) {
+        uint64_t counter = (old >> shift) & COUNTER_MAX;
+        if (counter == COUNTER_MAX || (delta < 0 && counter == 0)) {
+            return 0;
+        }
+        uint64_t updated = delta > 0 ? old + (1ULL << shift) : old - (1ULL << shift);
+        if (__atomic_compare_exchange_n(word, &old, updated, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+    }
+}
+
+static inline __attribute__((always_inline)) void counting_insert_k(struct bloom_filter *filter, uint64_t hash, int k) {
+    uint64_t h2 = bloom_second_hash(hash);
+    for (int j = 0; j < k; j++) {
+        uint64_t index = bloom_probe_index(hash, h2, j, filter->mask);
+        counter_add(&filter->words[index >> 4], (int)(index & 15) * COUNTER_BITS, 1);
+    }
+}
+
+static inline __attribute__((always_inline)) int counting_query_k(const struct bloom_filter *filter, uint64_t hash, int k) {
+    uint64_t h2 = bloom_second_hash(hash);
+    for (int j = 0; j < k; j++) {
+        uint64_t index = bloom_probe_index(hash, h2, j, filter->mask);
+        if (((filter->words[index >> 4] >> ((index & 15) * COUNTER_BITS)) & COUNTER_MAX) == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+#define DEFINE_PROBE_FUNCTIONS(K) \
+    void classic_insert_##K(struct bloom_filter *filter, uint64_t hash) { classic_insert_k(filter, hash, K); } \
+    int classic_query_##K(const struct bloom_filter *filter, uint64_t hash) { return classic_query_k(filter, hash, K); } \
+    void blocked_insert_##K(struct bloom_filter *filter, uint64_t hash) { blocked_insert_k(filter, hash, K); } \
+    int blocked_query_##K(const struct bloom_filter *filter, uint64_t hash) { return blocked_query_k(filter, hash, K); } \
+    void counting_insert_##K(struct bloom_filter *filter, uint64_t hash) { counting_insert_k(filter, hash, K); } \
+    int counting_query_##K(const struct bloom_filter *filter, uint64_t hash) { return counting_query_k(filter, hash, K); }
+
+DEFINE_PROBE_FUNCTIONS(1)
+DEFINE_PROBE_FUNCTIONS(2)
+DEFINE_PROBE_FUNCTIONS(3)
+DEFINE_PROBE_FUNCTIONS(4)
+DEFINE_PROBE_FUNCTIONS(5)
+DEFINE_PROBE_FUNCTIONS(6)
+DEFINE_PROBE_FUNCTIONS(7)
+DEFINE_PROBE_FUNCTIONS(8)
+
+// any other k runs the same loops with k read from the filter
+void classic_insert_any(struct bloom_filter *filter, uint64_t hash) { classic_insert_k(filter, hash, filter->k); }
+int classic_query_any(const struct bloom_filter *filter, uint64_t hash) { return classic_query_k(filter, hash, filter->k); }
+void blocked_insert_any(struct bloom_filter *filter, uint64_t hash) { blocked_insert_k(filter, hash, filter->k); }
+int blocked_query_any(const struct bloom_filter *filter, uint64_t hash) { return blocked_query_k(filter, hash, filter->k); }
+void counting_insert_any(struct bloom_filter *filter, uint64_t hash) { counting_insert_k(filter, hash, filter->k); }
+int counting_query_any(const struct bloom_filter *filter, uint64_t hash) { return counting_query_k(filter, hash, filter->k); }
+
+/*
+Function Description: points the filter's 'insert' and 'query' at the probe functions for
+its kind and k, and sets its index 'mask'.
+*/
+void bloom_filter_set_probes(struct bloom_filter *filter) {
+    static void (*const classic_inserts[])(struct bloom_filter *, uint64_t) = {
+        classic_insert_any, classic_insert_1, classic_insert_2, classic_insert_3, classic_insert_4,
+        classic_insert_5, classic_insert_6, classic_insert_7, classic_insert_8};
+    static int (*const classic_queries[])(const struct bloom_filter *, uint64_t) = {
+        classic_query_any, classic_query_1, classic_query_2, classic_query_3, classic_query_4,
+        classic_query_5, classic_query_6, classic_query_7, classic_query_8};
+    static void (*const blocked_inserts[])(struct bloom_filter *, uint64_t) = {
+        blocked_insert_any, blocked_insert_1, blocked_insert_2, blocked_insert_3, blocked_insert_4,
+        blocked_insert_5, blocked_insert_6, blocked_insert_7, blocked_insert_8};
+    static int (*const blocked_queries[])(const struct bloom_filter *, uint64_t) = {
+        blocked_query_any, blocked_query_1, blocked_query_2, blocked_query_3, blocked_query_4,
+        blocked_query_5, blocked_query_6, blocked_query_7, blocked_query_8};
+    static void (*const counting_inserts[])(struct bloom_filter *, uint64_t) = {
+        counting_insert_any, counting_insert_1, counting_insert_2, counting_insert_3, counting_insert_4,
+        counting_insert_5, counting_insert_6, counting_insert_7, counting_insert_8};
+    static int (*const counting_queries[])(const struct bloom_filter *, uint64_t) = {
+        counting_query_any, counting_query_1, counting_query_2, counting_query_3, counting_query_4,
+        counting_query_5, counting_query_6, counting_query_7, counting_query_8};
+
+    int specialized = filter->k <= MAX_SPECIALIZED_K ? filter->k : 0;
+    if (filter->kind == FILTER_BLOCKED) {
+        filter->mask = filter->m / BLOCK_BITS - 1;
+        filter->insert = blocked_inserts[specialized];
+        filter->query = blocked_queries[specialized];
+    } else if (filter->kind == FILTER_COUNTING) {
+        filter->mask = filter->m - 1;
+        filter->insert = counting_inserts[specialized];
+        filter->query = counting_queries[specialized];
+    } else {
+        filter->mask = filter->m - 1;
+        filter->insert = classic_inserts[specialized];
+        filter->query = classic_queries[specialized];
+    }
+}
+
+/*
+Function Description: the number of uint64_t words a filter of the given 'kind' and 'm'
+positions is stored in: m bits, or m 4-bit counters for a counting filter, rounded up to
+whole cache lines.
+*/
+size_t filter_num_words(enum filter_kind kind, uint64_t m) {
+    uint64_t bits = kind == FILTER_COUNTING ? m * COUNTER_BITS : m;
+    return (size_t)((bits + 511) / 512 * 8);
+}
+
+/*
+Function Description: allocates a filter of the given 'kind' with 'm' bits (a power of two,
+and at least one block for a blocked filter) and 'k' bits per word, without touching its
+words: the caller zeroes them, which lets it choose the thread that does (see
+sharded_filter_init). Returns 1 on success, 0 if memory allocation has failed.
+*/
+int bloom_filter_alloc(struct bloom_filter *filter, enum filter_kind kind, uint64_t m, int k) {
+    filter->kind = kind;
+    filter->m = m;
+    filter->k = k;
+    filter->mapping = NULL;
+    filter->mapping_size = 0;
+    filter->num_words = filter_num_words(kind, m);
+    bloom_filter_set_probes(filter);
+    filter->words = (uint64_t *)aligned_alloc(64, filter->num_words * sizeof(uint64_t));
+    return filter->words != NULL;
+}
+
+/*
+Function Description: allocates a zeroed filter (see bloom_filter_alloc). Returns 1 on
+success, 0 if memory allocation has failed.
+*/
+int bloom_filter_init(struct bloom_filter *filter, enum filter_kind kind, uint64_t m, int k) {
+    if (!bloom_filter_alloc(filter, kind, m, k)) {
+        return 0;
+    }
+    memset(filter->words, 0, filter->num_words * sizeof(uint64_t));
+    return 1;
+}
+
+void bloom_filter_free(struct bloom_filter *filter) {
+    if (filter->mapping != NULL) {
+        munmap(filter->mapping, filter->mapping_size);
+        filter->mapping = NULL;
+    } else {
+        free(filter->words);
+    }
+    filter->words = NULL;
+}
+
+size_t bloom_filter_bytes(const struct bloom_filter *filter) {
+    return filter->num_words * sizeof(uint64_t);
+}
+
+/*
+Function Description: sets the k bits of a word in the filter. The word is given by its
+64-bit 'hash' (as stored in the string set), so the word itself is never hashed again.
+Several OpenMP threads can insert into the same filter at once.
+*/
+void bloom_insert(struct bloom_filter *filter, uint64_t hash) {
+    filter->insert(filter, hash);
+}
+
+/*
+Function Description: returns 1 if all k bits of the word with 64-bit 'hash' are set (the
+word is potentially in the filter), 0 as soon as one of them is not.
+*/
+int bloom_query(const struct bloom_filter *filter, uint64_t hash) {
+    return filter->query(filter, hash);
+}
+
+/*
+Function Description: removes the word with 64-bit 'hash' from a counting filter by
+decrementing its k counters. Only words that were inserted may be removed: removing a word
+that was never inserted but happens to be a false positive takes counts away from other
+words and can make them disappear. A word the filter reports as absent is certainly not in
+it, so nothing is changed; saturated counters are never decremented. Several OpenMP threads
+can insert and remove at once. Returns 1 if the counters were decremented, 0 if the word was
+absent.
+*/
+int bloom_remove(struct bloom_filter *filter, uint64_t hash) {
+    if (!bloom_query(filter, hash)) {
+        return 0;
+    }
+    uint64_t h2 = bloom_second_hash(hash);
+    for (int j = 0; j < filter->k; j++) {
+        uint64_t index = bloom_probe_index(hash, h2, j, filter->mask);
+        counter_add(&filter->words[index >> 4], (int)(index & 15) * COUNTER_BITS, -1);
+    }
+    return 1;
+}
+
+/*
+Function Description: the instrumented versions of bloom_insert and bloom_query, used in their
+place while instrumentation is on. They probe exactly the positions the specialized probe
+functions do, through one generic loop over probe_location, and also report what they saw:
+bloom_insert_counted returns how many of the k probes found their bit (or counter) already
+set, and bloom_query_counted adds the number of probes it made to 'probes' (all of them
+but the last found their bit set).
+*/
+static inline uint64_t *probe_location(const struct bloom_filter *filter, uint64_t hash, uint64_t h2,
+                                       uint64_t *bits, int j, uint64_t *mask) {
+    if (filter->kind == FILTER_BLOCKED) {
+        int position = blocked_bit_position(bits, j);
+        *mask = 1ULL << (position & 63);
+        return blocked_block(filter, hash) + (position >> 6);
+    }
+    uint64_t index = bloom_probe_index(hash, h2, j, filter->mask);
+    if (filter->kind == FILTER_COUNTING) {
+        *mask = (uint64_t)COUNTER_MAX << ((index & 15) * COUNTER_BITS);
+        return filter->words + (index >> 4);
+    }
+    *mask = 1ULL << (index & 63);
+    return filter->words + (index >> 6);
+}
+
+int bloom_insert_counted(struct bloom_filter *filter, uint64_t hash) {
+    uint64_t h2 = bloom_second_hash(hash);
+    uint64_t bits = hash;
+    int hits = 0;
+    for (int j = 0; j < filter->k; j++) {
+        uint64_t mask;
+        uint64_t *word = probe_location(filter, hash, h2, &bits, j, &mask);
+        if (filter->kind == FILTER_COUNTING) {
+            hits += (__atomic_load_n(word, __ATOMIC_RELAXED) & mask) != 0;
+            counter_add(word, __builtin_ctzll(mask), 1);
+        } else {
+            hits += (__atomic_fetch_or(word, mask, __ATOMIC_RELAXED) & mask) != 0;
+        }
+    }
+    return hits;
+}
+
+int bloom_query_counted(const struct bloom_filter *filter, uint64_t hash, uint64_t *probes) {
+    uint64_t h2 = bloom_second_hash(hash);
+    uint64_t bits = hash;
+    for (int j = 0; j < filter->k; j++) {
+        uint64_t mask;
+        const uint64_t *word = probe_location(filter, hash, h2, &bits, j, &mask);
+        (*probes)++;
+        if ((*word & mask) == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+Function Description: counts the counters of a counting filter that have reached COUNTER_MAX.
+A handful is expected in a large filter; many of them mean the filter is overloaded and
+removals are no longer freeing its positions.
+*/
+uint64_t counting_saturated_counters(const struct bloom_filter *filter) {
+    uint64_t saturated = 0;
+    for (size_t w = 0; w < filter->num_words; w++) {
+        uint64_t x = filter->words[w];
+        saturated += __builtin_popcountll(x & (x >> 1) & (x >> 2) & (x >> 3) & 0x1111111111111111ULL);
+    }
+    return saturated;
+}
+
+/*
+Function Description: fills 'hashes' with the hashes of up to held_out_count(set) held-out
+words for measuring the real false positive rate of a filter built from the words in 'set'.
+The held-out words are derived from the file's own words (word + "#" + counter, so they have
+a realistic length and alphabet) and are checked against the set to make sure none of them
+was actually inserted. Returns the number of hashes written.
+
+held_out_count scales the test with the file: ten held-out words per unique word, at least
+FP_TEST_MIN_WORDS and at most FP_TEST_WORDS. A corpus of thousands of small files would
+otherwise spend most of its time generating 100000 test words for every one of them.
+*/
+int held_out_count(const struct string_set *set) {
+    long long count = 10LL * set->count;
+    return count < FP_TEST_MIN_WORDS ? FP_TEST_MIN_WORDS : count > FP_TEST_WORDS ? FP_TEST_WORDS : (int)count;
+}
+
+int held_out_hashes(const struct string_set *set, uint64_t *hashes) {
+    int tested = 0;
+    int count = held_out_count(set);
+
+    // tokens have no length limit, so the probe buffer fits the longest word plus "#" and the counter
+    size_t longest = 0;
+    for (int i = 0; i < set->count; i++) {
+        longest = set->entries[i].len > longest ? set->entries[i].len : longest;
+    }
+    size_t capacity = longest + 16;
+    char *probe = (char *)malloc(capacity);
+    if (probe == NULL) {
+        return 0;
+    }
+    for (int t = 0; t < count && set->count > 0; t++) {
+        int len = snprintf(probe, capacity, "%s#%d", string_set_word(set, t % set->count), t);
+        if (string_set_contains(set, probe, len)) {
+            continue;
+        }
+        hashes[tested++] = string_hash(probe, len);
+    }
+    free(probe);
+    return tested;
+}
+
+/*
+Function Description: fills 'hashes' with the hashes of 'count' held-out words that no file
+can contain: they have a space in them, and a token never does. Unlike held_out_hashes this
+needs no set of words to check against, so it works for filters built from many files or
+without deduplication.
+*/
+void absent_word_hashes(uint64_t *hashes, int count) {
+    for (int t = 0; t < count; t++) {
+        char probe[32];
+        int len = snprintf(probe, sizeof(probe), "held out %d", t);
+        hashes[t] = string_hash(probe, len);
+    }
+}
+
+/*
+Function Description: prefetches the cache lines the word with 64-bit 'hash' will probe: the
+k lines of its bits in a classic filter, or its single block in a blocked filter.
+*/
+void bloom_prefetch(const struct bloom_filter *filter, uint64_t hash) {
+    if (filter->kind == FILTER_BLOCKED) {
+        __builtin_prefetch(blocked_block(filter, hash));
+        return;
+    }
+    int shift = filter->kind == FILTER_COUNTING ? 4 : 6;
+    uint64_t h2 = bloom_second_hash(hash);
+    for (int j = 0; j < filter->k; j++) {
+        __builtin_prefetch(&filter->words[bloom_probe_index(hash, h2, j, filter->mask) >> shift]);
+    }
+}
+
+/*
+Function Description: queries 'count' words given by their hashes and writes 1 (potentially
+present) or 0 (absent) for each of them to 'results'. All probe locations of the batch are
+prefetched before any bit is tested, so the cache misses of the batch overlap instead of
+being paid one after another.
+*/
+void bloom_query_batch(const struct bloom_filter *filter, const uint64_t *hashes, int count, unsigned char *results) {
+    for (int i = 0; i < count; i++) {
+        bloom_prefetch(filter, hashes[i]);
+    }
+    for (int i = 0; i < count; i++) {
+        results[i] = (unsigned char)bloom_query(filter, hashes[i]);
+    }
+}
+
+/*
+Struct Description: a list of query words read from a file (memory mapped) or from stdin
+(read into 'buffer'). 'words' and 'lengths' are views into that text, one per whitespace
+separated token, and 'hashes' holds their string_hash once hash_query_set has run.
+*/
+struct query_set {
+    struct mapped_file file;
+    char *buffer;
+    const char **words;
+    size_t *lengths;
+    uint64_t *hashes;
+    int count;
+};
+
+/*
+Function Description: reads the query words from 'filename', or from stdin if it is "-".
+Returns 1 on success, 0 on a read or memory allocation error.
+*/
+int load_query_set(const char *filename, struct query_set *queries) {
+    memset(queries, 0, sizeof(*queries));
+    const char *data;
+    size_t size;
+    if (strcmp(filename, "-") == 0) {
+        size_t cap = 65536;
+        size = 0;
+        queries->buffer = (char *)malloc(cap);
+        while (queries->buffer != NULL) {
+            size += fread(queries->buffer + size, 1, cap - size, stdin);
+            if (size < cap) {
+                break;
+            }
+            cap *= 2;
+            char *grown = (char *)realloc(queries->buffer, cap);
+            if (grown == NULL) {
+                free(queries->buffer);
+            }
+            queries->buffer = grown;
+        }
+        if (queries->buffer == NULL) {
+            perror("Memory allocation has failed");
+            return 0;
+        }
+        data = queries->buffer;
+    } else {
+        if (!map_file(filename, &queries->file)) {
+            perror("There's an error opening the query file");
+            return 0;
+        }
+        data = queries->file.data;
+        size = queries->file.size;
+    }
+
+    int cap = 0;
+    struct token_scanner scanner;
+    token_scanner_init(&scanner, data, size, 0);
+    const char *token;
+    size_t len;
+    while (token_scanner_next(&scanner, &token, &len)) {
+        if (queries->count == cap) {
+            cap = cap ? cap * 2 : 1024;
+            const char **words = (const char **)realloc(queries->words, cap * sizeof(const char *));
+            if (words != NULL) {
+                queries->words = words;
+            }
+            size_t *lengths = (size_t *)realloc(queries->lengths, cap * sizeof(size_t));
+            if (lengths != NULL) {
+                queries->lengths = lengths;
+            }
+            if (words == NULL || lengths == NULL) {
+                perror("Memory allocation has failed");
+                return 0;
+            }
+        }
+        queries->words[queries->count] = token;
+        queries->lengths[queries->count] = len;
+        queries->count++;
+    }
+    queries->hashes = (uint64_t *)malloc((queries->count + 1) * sizeof(uint64_t));
+    if (queries->hashes == NULL) {
+        perror("Memory allocation has failed");
+        return 0;
+    }
+    return 1;
+}
+
+void free_query_set(struct query_set *queries) {
+    unmap_file(&queries->file);
+    free(queries->buffer);
+    free(queries->words);
+    free(queries->lengths);
+    free(queries->hashes);
+    memset(queries, 0, sizeof(*queries));
+}
+
+/*
+Function Description: hashes every query word once, in parallel; the hashes are then reused
+for every filter the words are looked up in.
+*/
+void hash_query_set(struct query_set *queries) {
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < queries->count; i++) {
+        queries->hashes[i] = string_hash(queries->words[i], queries->lengths[i]);
+    }
+}
+
+/*
+Function Description: looks up every query word in 'filter' and writes one result byte per
+word to 'results'. The words are cut into batches of QUERY_BATCH that are spread over the
+OpenMP threads, and each batch is answered by bloom_query_batch.
+*/
+void query_filter(const struct bloom_filter *filter, const struct query_set *queries, unsigned char *results) {
+    int num_batches = (queries->count + QUERY_BATCH - 1) / QUERY_BATCH;
+    #pragma omp parallel
+    {
+        struct thread_stats *stats = thread_stats();
+        double start_time = instrument_start(stats);
+        #pragma omp for schedule(static) nowait
+        for (int b = 0; b < num_batches; b++) {
+            int first = b * QUERY_BATCH;
+            int count = queries->count - first < QUERY_BATCH ? queries->count - first : QUERY_BATCH;
+            bloom_query_batch(filter, queries->hashes + first, count, results + first);
+        }
+        instrument_end(stats, PHASE_QUERY, start_time);
+    }
+}
+
+/*
+Struct Description: the header of a filter file. A filter file is this header, zero padding
+up to FILTER_FILE_DATA_OFFSET, and then the filter's 'num_words' packed words exactly as they
+are in memory. Because the data starts on a page boundary, load_filter can map the file and
+use the words in place: pages are only read from disk when a query first touches them. All
+fields are in native byte order. 'data_checksum' is the string_hash of the words and
+'header_checksum' the string_hash of every header byte before it.
+*/
+struct filter_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t kind;
+    uint32_t k;
+    uint32_t reserved;
+    uint64_t m;
+    uint64_t seed;
+    uint64_t n;
+    uint64_t num_words;
+    uint64_t data_checksum;
+    uint64_t header_checksum;
+};
+
+/*
+Function Description: writes 'filter', built from 'n' unique words, to the filter file 'path'.
+The file is written under a temporary name and renamed into place, so a reader never maps
+a half-written filter. Returns 1 on success, 0 on failure.
+*/
+int save_filter(const struct bloom_filter *filter, int n, const char *path) {
+    struct filter_file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FILTER_FILE_MAGIC, sizeof(header.magic));
+    header.version = FILTER_FILE_VERSION;
+    header.kind = filter->kind;
+    header.k = (uint32_t)filter->k;
+    header.m = filter->m;
+    header.seed = HASH_SEED;
+    header.n = (uint64_t)n;
+    header.num_words = filter->num_words;
+    header.data_checksum = string_hash((const char *)filter->words, bloom_filter_bytes(filter));
+    header.header_checksum = string_hash((const char *)&header, offsetof(struct filter_file_header, header_checksum));
+
+    char temp_path[4096];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE *file = fopen(temp_path, "wb");
+    if (file == NULL) {
+        perror("There's an error creating the filter file");
+        return 0;
+    }
+    static const char padding[FILTER_FILE_DATA_OFFSET] = {0};
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(padding, FILTER_FILE_DATA_OFFSET - sizeof(header), 1, file) == 1 &&
+             fwrite(filter->words, sizeof(uint64_t), filter->num_words, file) == filter->num_words;
+    if (fclose(file) != 0) {
+        ok = 0;
+    }
+    if (!ok || rename(temp_path, path) != 0) {
+        perror("There's an error writing the filter file");
+        remove(temp_path);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+Function Description: maps the filter file 'path' read-only and sets up 'filter' to use the
+words in place, so the filter can answer queries as soon as this returns. The header is
+always validated (magic, version, checksum, and that its kind, k and hash seed are ones this
+program can query); the data checksum is only verified if 'verify' is set, because that reads
+the whole file. Stores the number of words the filter was built from in 'n'. Returns 1 on
+success, 0 on failure.
+*/
+int load_filter(const char *path, int verify, struct bloom_filter *filter, uint64_t *n) {
+    struct mapped_file file;
+    if (!map_file(path, &file)) {
+        perror("There's an error opening the filter file");
+        return 0;
+    }
+    struct filter_file_header header;
+    if (file.size < FILTER_FILE_DATA_OFFSET) {
+        fprintf(stderr, "%s: not a filter file\n", path);
+        unmap_file(&file);
+        return 0;
+    }
+    memcpy(&header, file.data, sizeof(header));
+    const char *problem = NULL;
+    if (memcmp(header.magic, FILTER_FILE_MAGIC, sizeof(header.magic)) != 0) {
+        problem = "not a filter file";
+    } else if (header.version != FILTER_FILE_VERSION) {
+        problem = "unsupported filter file version";
+    } else if (header.header_checksum != string_hash((const char *)&header, offsetof(struct filter_file_header, header_checksum))) {
+        problem = "header checksum mismatch";
+    } else if (header.kind >= NUM_FILTER_KINDS || header.k < 1 || header.k > MAX_HASH_FUNCTIONS || header.seed != HASH_SEED ||
+               header.m < 64 || (header.m & (header.m - 1)) != 0 || (header.kind == FILTER_BLOCKED && header.m < BLOCK_BITS) ||
+               header.num_words != filter_num_words((enum filter_kind)header.kind, header.m)) {
+        problem = "filter parameters not supported by this program";
+    } else if (file.size < FILTER_FILE_DATA_OFFSET + header.num_words * sizeof(uint64_t)) {
+        problem = "truncated filter file";
+    } else if (verify && header.data_checksum != string_hash(file.data + FILTER_FILE_DATA_OFFSET, header.num_words * sizeof(uint64_t))) {
+        problem = "data checksum mismatch";
+    }
+    if (problem != NULL) {
+        fprintf(stderr, "%s: %s\n", path, problem);
+        unmap_file(&file);
+        return 0;
+    }
+
+    madvise((void *)file.data, file.size, MADV_RANDOM); // queries touch pages in no particular order
+    filter->words = (uint64_t *)(file.data + FILTER_FILE_DATA_OFFSET);
+    filter->num_words = header.num_words;
+    filter->m = header.m;
+    filter->k = (int)header.k;
+    filter->kind = (enum filter_kind)header.kind;
+    bloom_filter_set_probes(filter);
+    filter->mapping = (void *)file.data;
+    filter->mapping_size = file.size;
+    *n = header.n;
+    return 1;
+}
+
+/*
+Struct Description: a static binary fuse filter (Graf and Lemire, "Binary Fuse Filters: Fast
+and Smaller Than Xor Filters", 2022) over a fixed set of words. Every word maps to three
+positions of the 'fingerprints' array, one in each of three consecutive segments of
+'segment_length' entries, and the filter is built so that the XOR of the three entries equals
+the word's 8- or 16-bit fingerprint. A lookup is therefore exactly three memory accesses and
+a compare, and the false positive rate is 2^-fingerprint_bits. The array holds about 1.125
+entries per word (a little more for small sets), so 8-bit fingerprints cost about 9 bits per
+word against the 1.44 * log2(1/rate) bits of an optimally sized Bloom filter at the same
+rate. Words cannot be added after the build, which suits filters built once from a fixed
+corpus.
+*/
+struct fuse_filter {
+    uint64_t seed;
+    uint32_t segment_length;
+    uint32_t segment_length_mask;
+    uint32_t segment_count;
+    uint32_t segment_count_length;
+    uint32_t array_length;
+    int fingerprint_bits;
+    void *fingerprints;
+};
+
+uint64_t fuse_mix(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static inline __attribute__((always_inline)) uint32_t fuse_fingerprint(const struct fuse_filter *filter, uint64_t hash) {
+    return (uint32_t)(hash ^ (hash >> 32)) & ((1U << filter->fingerprint_bits) - 1);
+}
+
+/*
+Function Description: the three positions of a (mixed) word hash: the high bits of hash *
+segment_count_length pick the first segment and the position in it, and the next two
+segments get positions taken from other bits of the hash.
+*/
+static inline __attribute__((always_inline)) void fuse_positions(const struct fuse_filter *filter, uint64_t hash, uint32_t h[3]) {
+    h[0] = (uint32_t)(((unsigned __int128)hash * filter->segment_count_length) >> 64);
+    h[1] = h[0] + filter->segment_length;
+    h[2] = h[1] + filter->segment_length;
+    h[1] ^= (uint32_t)(hash >> 18) & filter->segment_length_mask;
+    h[2] ^= (uint32_t)hash & filter->segment_length_mask;
+}
+
+static inline __attribute__((always_inline)) uint32_t fuse_entry(const struct fuse_filter *filter, uint32_t i) {
+    return filter->fingerprint_bits == 8 ? ((const uint8_t *)filter->fingerprints)[i]
+                                         : ((const uint16_t *)filter->fingerprints)[i];
+}
+
+/*
+Function Description: returns 1 if the word with the string_hash 'key' may be in the filter,
+0 if it is certainly not.
+*/
+int fuse_query(const struct fuse_filter *filter, uint64_t key) {
+    uint64_t hash = fuse_mix(key + filter->seed);
+    uint32_t h[3];
+    fuse_positions(filter, hash, h);
+    return fuse_fingerprint(filter, hash) == (fuse_entry(filter, h[0]) ^ fuse_entry(filter, h[1]) ^ fuse_entry(filter, h[2]));
+}
+
+/*
+Function Description: the fuse filter counterpart of bloom_query_batch: prefetches the three
+entries of every word of the batch before comparing any fingerprint.
+*/
+void fuse_query_batch(const struct fuse_filter *filter, const uint64_t *keys, int count, unsigned char *results) {
+    size_t entry_bytes = filter->fingerprint_bits / 8;
+    for (int i = 0; i < count; i++) {
+        uint32_t h[3];
+        fuse_positions(filter, fuse_mix(keys[i] + filter->seed), h);
+        for (int j = 0; j < 3; j++) {
+            __builtin_prefetch((const char *)filter->fingerprints + h[j] * entry_bytes);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        results[i] = (unsigned char)fuse_query(filter, keys[i]);
+    }
+}
+
+/*
+Function Description: sizes 'filter' for 'size' words: the segment length grows with the
+number of words (up to 2^18 entries), and the array has about size * 1.125 entries, rounded
+to whole segments, plus two extra segments so that the last segment a word can start in
+still has two after it.
+*/
+void fuse_filter_size(struct fuse_filter *filter, uint32_t size) {
+    filter->segment_length = size == 0 ? 4 : 1U << (int)floor(log((double)size) / log(3.33) + 2.25);
+    if (filter->segment_length > 262144) {
+        filter->segment_length = 262144;
+    }
+    filter->segment_length_mask = filter->segment_length - 1;
+    double size_factor = size <= 1 ? 0.0 : fmax(1.125, 0.875 + 0.25 * log(1000000.0) / log((double)size));
+    uint32_t capacity = (uint32_t)round((double)size * size_factor);
+    int64_t segment_count = ((int64_t)capacity + filter->segment_length - 1) / filter->segment_length - 2;
+    filter->segment_count = segment_count < 1 ? 1 : (uint32_t)segment_count;
+    filter->array_length = (filter->segment_count + 2) * filter->segment_length;
+    filter->segment_count_length = filter->segment_count * filter->segment_length;
+}
+
+void fuse_filter_free(struct fuse_filter *filter) {
+    free(filter->fingerprints);
+    filter->fingerprints = NULL;
+}
+
+size_t fuse_filter_bytes(const struct fuse_filter *filter) {
+    return (size_t)filter->array_length * (filter->fingerprint_bits / 8);
+}
+
+/*
+Function Description: builds 'filter', with 'fingerprint_bits' (8 or 16) bit fingerprints,
+over the 'size' words given by their string_hash in 'keys'. The build is the peeling
+algorithm of the paper: every array entry keeps the number of words that map to it and the
+XOR of their hashes, so an entry with a single word reveals that word. Such words are peeled
+off one after another and pushed on a stack, and if every word gets peeled, the fingerprints
+are assigned in the reverse order, each word setting the one entry no word peeled after it
+uses. If the peeling gets stuck the build is retried with another seed; words are first
+ordered by the segment they start in so that the counting passes walk the arrays mostly in
+order. Duplicate keys are detected and counted once. Returns 1 on success, 0 if memory
+allocation has failed or no seed worked.
+*/
+int fuse_filter_build(struct fuse_filter *filter, const uint64_t *keys, uint32_t size, int fingerprint_bits) {
+    memset(filter, 0, sizeof(*filter));
+    filter->fingerprint_bits = fingerprint_bits;
+    fuse_filter_size(filter, size);
+    uint32_t array_length = filter->array_length;
+
+    uint32_t block_bits = 1;
+    while ((1U << block_bits) < filter->segment_count) {
+        block_bits++;
+    }
+    size_t block = (size_t)1 << block_bits;
+    uint64_t *reverse_order = (uint64_t *)calloc((size_t)size + 1, sizeof(uint64_t));
+    uint8_t *reverse_h = (uint8_t *)malloc((size_t)size + 1);
+    uint8_t *t2count = (uint8_t *)calloc(array_length, 1);
+    uint64_t *t2hash = (uint64_t *)calloc(array_length, sizeof(uint64_t));
+    uint32_t *alone = (uint32_t *)malloc((size_t)array_length * sizeof(uint32_t));
+    size_t *start_pos = (size_t *)malloc(block * sizeof(size_t));
+    filter->fingerprints = calloc(array_length, fingerprint_bits / 8);
+    int ok = reverse_order != NULL && reverse_h != NULL && t2count != NULL && t2hash != NULL &&
+             alone != NULL && start_pos != NULL && filter->fingerprints != NULL;
+
+    uint64_t seed_state = HASH_SEED;
+    uint32_t duplicates = 0;
+    int built = 0;
+    for (int attempt = 0; ok && attempt < 100 && !built; attempt++) {
+        filter->seed = fuse_mix(seed_state += 0x9e3779b97f4a7c15ULL);
+        memset(reverse_order, 0, (size_t)size * sizeof(uint64_t));
+        memset(t2count, 0, array_length);
+        memset(t2hash, 0, (size_t)array_length * sizeof(uint64_t));
+        reverse_order[size] = 1; // sentinel, stops the search for a free slot below
+
+        // order the mixed hashes by the block of segments they start in
+        for (size_t b = 0; b < block; b++) {
+            start_pos[b] = (b * size) >> block_bits;
+        }
+        for (uint32_t i = 0; i < size; i++) {
+            uint64_t hash = fuse_mix(keys[i] + filter->seed);
+            size_t segment_index = hash >> (64 - block_bits);
+            while (reverse_order[start_pos[segment_index]] != 0) {
+                segment_index = (segment_index + 1) & (block - 1);
+            }
+            reverse_order[start_pos[segment_index]] = hash;
+            start_pos[segment_index]++;
+        }
+
+        // count the words of every entry; the low two bits XOR which of its three positions each word uses there
+        int overflow = 0;
+        duplicates = 0;
+        for (uint32_t i = 0; i < size; i++) {
+            uint64_t hash = reverse_order[i];
+            uint32_t h[3];
+            fuse_positions(filter, hash, h);
+            for (int j = 0; j < 3; j++) {
+                t2count[h[j]] = (uint8_t)((t2count[h[j]] + 4) ^ j);
+                t2hash[h[j]] ^= hash;
+            }
+            // a second copy of a word cancels the first out of t2hash, leaving exactly two words' worth of count
+            if ((t2hash[h[0]] & t2hash[h[1]] & t2hash[h[2]]) == 0 &&
+                ((t2hash[h[0]] == 0 && t2count[h[0]] == 8) || (t2hash[h[1]] == 0 && t2count[h[1]] == 8) ||
+                 (t2hash[h[2]] == 0 && t2count[h[2]] == 8))) {
+                duplicates++;
+                for (int j = 0; j < 3; j++) {
+                    t2count[h[j]] = (uint8_t)((t2count[h[j]] - 4) ^ j);
+                    t2hash[h[j]] ^= hash;
+                }
+            }
+            for (int j = 0; j < 3; j++) {
+                overflow |= t2count[h[j]] < 4;
+            }
+        }
+        if (overflow) {
+            continue;
+        }
+
+        // peel: the stack of peeled words reuses reverse_order, with their position index in reverse_h
+        uint32_t queue_size = 0;
+        for (uint32_t i = 0; i < array_length; i++) {
+            alone[queue_size] = i;
+            queue_size += (t2count[i] >> 2) == 1;
+        }
+        uint32_t stack_size = 0;
+        while (queue_size > 0) {
+            uint32_t index = alone[--queue_size];
+            if ((t2count[index] >> 2) != 1) {
+                continue;
+            }
+            uint64_t hash = t2hash[index];
+            uint32_t h012[5];
+            fuse_positions(filter, hash, h012);
+            h012[3] = h012[0];
+            h012[4] = h012[1];
+            uint8_t found = t2count[index] & 3;
+            reverse_h[stack_size] = found;
+            reverse_order[stack_size] = hash;
+            stack_size++;
+            for (int j = 1; j <= 2; j++) {
+                uint32_t other = h012[found + j];
+                alone[queue_size] = other;
+                queue_size += (t2count[other] >> 2) == 2;
+                t2count[other] = (uint8_t)((t2count[other] - 4) ^ ((found + j) % 3));
+                t2hash[other] ^= hash;
+            }
+        }
+        built = stack_size + duplicates == size;
+    }
+
+    if (built) {
+        for (uint32_t i = size - duplicates; i-- > 0;) {
+            uint64_t hash = reverse_order[i];
+            uint32_t h012[5];
+            fuse_positions(filter, hash, h012);
+            h012[3] = h012[0];
+            h012[4] = h012[1];
+            uint8_t found = reverse_h[i];
+            uint32_t value = fuse_fingerprint(filter, hash) ^ fuse_entry(filter, h012[found + 1]) ^ fuse_entry(filter, h012[found + 2]);
+            if (fingerprint_bits == 8) {
+                ((uint8_t *)filter->fingerprints)[h012[found]] = (uint8_t)value;
+            } else {
+                ((uint16_t *)filter->fingerprints)[h012[found]] = (uint16_t)value;
+            }
+        }
+    } else {
+        fuse_filter_free(filter);
+    }
+    free(reverse_order);
+    free(reverse_h);
+    free(t2count);
+    free(t2hash);
+    free(alone);
+    free(start_pos);
+    return built;
+}
+
+double per_second(double count, double seconds) {
+    return seconds > 0 ? count / seconds : 0.0;
+}
+
+/*
+Struct Description: what building one filter over one file cost and how well it did. main()
+sums these per filter kind so that the kinds can be compared side by side.
+*/
+struct filter_result {
+    uint64_t m;
+    size_t filter_bytes;
+    size_t unpacked_bytes;     // what one int per bit (or counter) would have taken
+    double unique_words;       // the words the filter holds, for the bits per word (an estimate with -g and -E)
+    double inserts;            // the insert operations, for the insert throughput (every token when streaming)
+    double insert_time;
+    double queries;
+    double query_time;
+    double false_positives;
+    double optimization_time;  // sizing + allocation + insertion + the test query
+};
+
+/*
+Function Description: sizes, allocates and fills a filter of the given 'kind' with the unique
+words of 'set', runs the "geohash" test query against it, and then queries the held-out
+hashes to measure the empirical false positive rate and the query throughput. The insertion
+loop is an OpenMP parallel for, so when it is not nested inside the per-file loop (split
+mode) every thread inserts into the same filter. Prints a report for the file and returns
+the numbers in 'result'. The filter is sized for the file's own words, unless 'common_m' is
+not 0: then it has 'common_m' bits and 'common_k' bits per word, so that filters of different
+files can be merged (see merge_filters). If 'save_path' is not NULL the finished filter is
+written to that filter file (see save_filter). If 'kept' is not NULL the filter is handed over to the caller
+through it instead of being freed. Returns 1 on success, 0 if memory allocation has failed.
+*/
+int build_filter(const char *filename, const struct string_set *set, enum filter_kind kind,
+                 uint64_t common_m, int common_k, const uint64_t *held_out, int num_held_out, struct filter_result *result,
+                 const char *save_path, struct bloom_filter *kept) {
+    const char *name = filter_kind_names[kind];
+    int n = set->count;
+    memset(result, 0, sizeof(*result));
+
+    double start_optimization_time = omp_get_wtime(); // Start measuring optimization time
+    struct thread_stats *stats = thread_stats();
+    double phase_start = instrument_start(stats);
+    uint64_t m = common_m;
+    int k = common_k;
+    if (m == 0) {
+        m = kind == FILTER_BLOCKED ? calc_blocked_bitArraySize(n, MAX_FP_RATE)
+                                   : calc_optimum_bitArraySize(n, MAX_FP_RATE);
+        k = calc_optimum_hash_functions(n, m);
+    }
+    double false_positive_rate = kind == FILTER_BLOCKED ? blocked_false_positive_rate(n, m, k)
+                                                        : classic_false_positive_rate(n, m, k);
+
+    /*
+    the filter packs its 'm' bits into uint64_t words, so it takes m / 8 bytes instead
+    of the m * sizeof(int) bytes a one-int-per-bit array would need.
+    */
+    struct bloom_filter filter;
+    if (!bloom_filter_init(&filter, kind, m, k)) {
+        perror("Memory allocation has failed");
+        return 0;
+    }
+    instrument_end(stats, PHASE_SIZING, phase_start);
+
+    double start_insert_time = omp_get_wtime();
+    #pragma omp parallel
+    {
+        struct thread_stats *thread = thread_stats();
+        double start_time = instrument_start(thread);
+        uint64_t inserted = 0, hits = 0;
+        #pragma omp for nowait
+        for (int i = 0; i < n; i++) {
+            if (thread != NULL) {
+                hits += bloom_insert_counted(&filter, set->entries[i].hash);
+                inserted++;
+            } else {
+                bloom_insert(&filter, set->entries[i].hash);
+            }
+        }
+        instrument_end(thread, PHASE_INSERT, start_time);
+        instrument_count(thread, COUNT_PROBES, inserted * k);
+        instrument_count(thread, COUNT_BIT_HITS, hits);
+    }
+    result->insert_time = omp_get_wtime() - start_insert_time;
+
+    const char *query = "geohash";
+    int is_present = bloom_query(&filter, string_hash(query, strlen(query)));
+    result->optimization_time = omp_get_wtime() - start_optimization_time;
+
+    double start_query_time = omp_get_wtime();
+    phase_start = instrument_start(stats);
+    int false_positives = 0;
+    if (stats != NULL) {
+        uint64_t probes = 0;
+        for (int t = 0; t < num_held_out; t++) {
+            false_positives += bloom_query_counted(&filter, held_out[t], &probes);
+        }
+        // every probe but the one that ended a rejected query found its bit set
+        instrument_count(stats, COUNT_PROBES, probes);
+        instrument_count(stats, COUNT_BIT_HITS, probes - (num_held_out - false_positives));
+    } else {
+        for (int t = 0; t < num_held_out; t++) {
+            false_positives += bloom_query(&filter, held_out[t]);
+        }
+    }
+    result->query_time = omp_get_wtime() - start_query_time;
+    instrument_end(stats, PHASE_QUERY, phase_start);
+
+    result->m = filter.m;
+    result->filter_bytes = bloom_filter_bytes(&filter);
+    result->unpacked_bytes = (size_t)filter.m * sizeof(int);
+    result->unique_words = n;
+    result->inserts = n;
+    result->queries = num_held_out;
+    result->false_positives = false_positives;
+
+    printf("[%s] %s: m = %llu bits, k = %d, %zu bytes (one int per bit would use %zu)\n",
+           name, filename, (unsigned long long)filter.m, filter.k, result->filter_bytes, result->unpacked_bytes);
+    printf("[%s] False Positive Rate: %f (empirical, held-out words: %f)\n",
+           name, false_positive_rate, num_held_out > 0 ? (double)false_positives / num_held_out : 0.0);
+    printf("[%s] Throughput (million words/s): insert %f, query %f\n",
+           name, per_second(n, result->insert_time) / 1e6, per_second(num_held_out, result->query_time) / 1e6);
+    if (kind == FILTER_COUNTING) {
+        printf("[%s] Saturated counters: %llu\n", name, (unsigned long long)counting_saturated_counters(&filter));
+    }
+    if (is_present) {
+        printf("[%s] The string '%s' is potentially in the bloom filter.\n", name, query);
+    } else {
+        printf("[%s] The string '%s' does not exist in the bloom filter.\n", name, query);
+    }
+
+    if (save_path != NULL && save_filter(&filter, n, save_path)) {
+        printf("[%s] Saved the filter to %s\n", name, save_path);
+    }
+    if (kept != NULL) {
+        *kept = filter;
+    } else {
+        bloom_filter_free(&filter);
+    }
+    return 1;
+}
+
+/*
+Function Description: the build_filter counterpart for the static binary fuse filter (-x):
+builds a filter with 'fingerprint_bits' bit fingerprints from the unique words of 'set',
+runs the "geohash" test query, and queries the held-out hashes to measure the empirical false
+positive rate and the query throughput. Prints a report for the file, including the bits
+spent per word, and returns the numbers in 'result' ('inserts' and 'insert_time' are the
+words and the time of the build). Returns 1 on success, 0 if the filter could not be built.
+*/
+int build_fuse_filter(const char *filename, const struct string_set *set, int fingerprint_bits,
+                      const uint64_t *held_out, int num_held_out, struct filter_result *result) {
+    char name[16];
+    snprintf(name, sizeof(name), "fuse%d", fingerprint_bits);
+    int n = set->count;
+    memset(result, 0, sizeof(*result));
+
+    double start_optimization_time = omp_get_wtime();
+    struct thread_stats *stats = thread_stats();
+    double phase_start = instrument_start(stats);
+    struct fuse_filter filter;
+    uint64_t *keys = (uint64_t *)malloc(((size_t)n + 1) * sizeof(uint64_t));
+    if (keys == NULL) {
+        perror("Memory allocation has failed");
+        return 0;
+    }
+    for (int i = 0; i < n; i++) {
+        keys[i] = set->entries[i].hash;
+    }
+    int built = fuse_filter_build(&filter, keys, (uint32_t)n, fingerprint_bits);
+    free(keys);
+    if (!built) {
+        fprintf(stderr, "[%s] %s: the filter could not be built\n", name, filename);
+        return 0;
+    }
+    result->insert_time = omp_get_wtime() - start_optimization_time;
+    instrument_end(stats, PHASE_INSERT, phase_start);
+
+    const char *query = "geohash";
+    int is_present = fuse_query(&filter, string_hash(query, strlen(query)));
+    result->optimization_time = omp_get_wtime() - start_optimization_time;
+
+    double start_query_time = omp_get_wtime();
+    phase_start = instrument_start(stats);
+    int false_positives = 0;
+    for (int t = 0; t < num_held_out; t++) {
+        false_positives += fuse_query(&filter, held_out[t]);
+    }
+    result->query_time = omp_get_wtime() - start_query_time;
+    instrument_end(stats, PHASE_QUERY, phase_start);
+    instrument_count(stats, COUNT_PROBES, 3 * (uint64_t)num_held_out);
+
+    result->m = (uint64_t)filter.array_length * fingerprint_bits;
+    result->filter_bytes = fuse_filter_bytes(&filter);
+    result->unpacked_bytes = result->filter_bytes;
+    result->unique_words = n;
+    result->inserts = n;
+    result->queries = num_held_out;
+    result->false_positives = false_positives;
+
+    printf("[%s] %s: %u fingerprints in segments of %u, %zu bytes, %f bits per word\n",
+           name, filename, filter.array_length, filter.segment_length, result->filter_bytes,
+           n > 0 ? 8.0 * result->filter_bytes / n : 0.0);
+    printf("[%s] False Positive Rate: %f (empirical, held-out words: %f)\n",
+           name, 1.0 / (1 << fingerprint_bits), num_held_out > 0 ? (double)false_positives / num_held_out : 0.0);
+    printf("[%s] Throughput (million words/s): build %f, query %f\n",
+           name, per_second(n, result->insert_time) / 1e6, per_second(num_held_out, result->query_time) / 1e6);
+    if (is_present) {
+        printf("[%s] The string '%s' is potentially in the filter.\n", name, query);
+    } else {
+        printf("[%s] The string '%s' does not exist in the filter.\n", name, query);
+    }
+    fuse_filter_free(&filter);
+    return 1;
+}
+
+/*
+Function Description: adds the numbers of one filter's 'result' to the running 'totals' of
+its kind; 'm' of the totals is the largest filter so far.
+*/
+void add_filter_result(struct filter_result *totals, const struct filter_result *result) {
+    if (result->m > totals->m) {
+        totals->m = result->m;
+    }
+    totals->filter_bytes += result->filter_bytes;
+    totals->unpacked_bytes += result->unpacked_bytes;
+    totals->unique_words += result->unique_words;
+    totals->inserts += result->inserts;
+    totals->insert_time += result->insert_time;
+    totals->queries += result->queries;
+    totals->query_time += result->query_time;
+    totals->false_positives += result->false_positives;
+}
+
+/*
+Function Description: builds a filter of every kind selected in 'selected' from the unique
+words of file number 'file_index', 'filename', held in 'set' (see build_filter), sharing one
+list of held-out words between them. Each filter is saved to 'save_dir' if that is not NULL,
+and handed over to kept_filters[file_index * NUM_FILTER_KINDS + kind] if 'kept_filters' is
+not NULL. If 'common_m' is not NULL every filter gets the size common_m[kind] and
+common_k[kind] instead of being sized for the file. If 'fuse_bits' is not 0 a binary fuse
+filter with fingerprints of that many bits is built as well (see build_fuse_filter), and its
+numbers are added to 'fuse_totals'. The numbers of every filter are added to 'kind_totals'
+inside a critical section, so any number of threads can build at once. Returns the time
+spent on optimization and insertion.
+*/
+double build_file_filters(const char *filename, int file_index, const struct string_set *set,
+                          const int selected[NUM_FILTER_KINDS], const uint64_t *common_m, const int *common_k,
+                          const char *save_dir, struct bloom_filter *kept_filters,
+                          struct filter_result kind_totals[NUM_FILTER_KINDS], int fuse_bits,
+                          struct filter_result *fuse_totals) {
+    double optimization_time = 0.0;
+    printf("Initial bit array size based on the number of unique words in %s: %d\n", filename, set->count);
+
+    uint64_t *held_out = (uint64_t *)malloc(held_out_count(set) * sizeof(uint64_t));
+    int num_held_out = held_out != NULL ? held_out_hashes(set, held_out) : 0;
+
+    for (int kind = 0; kind < NUM_FILTER_KINDS; kind++) {
+        struct filter_result result;
+        struct bloom_filter *kept = kept_filters != NULL ? &kept_filters[file_index * NUM_FILTER_KINDS + kind] : NULL;
+        char save_path[4096];
+        if (save_dir != NULL) {
+            const char *base = strrchr(filename, '/');
+            snprintf(save_path, sizeof(save_path), "%s/%s.%s.bloom", save_dir,
+                     base != NULL ? base + 1 : filename, filter_kind_names[kind]);
+        }
+        if (!selected[kind] || !build_filter(filename, set, kind, common_m != NULL ? common_m[kind] : 0,
+                                             common_k != NULL ? common_k[kind] : 0, held_out, num_held_out, &result,
+                                             save_dir != NULL ? save_path : NULL, kept)) {
+            continue;
+        }
+        optimization_time += result.optimization_time;
+
+        // the per-kind totals are shared by all threads, so they are updated one file at a time
+        #pragma omp critical
+        add_filter_result(&kind_totals[kind], &result);
+    }
+    struct filter_result result;
+    if (fuse_bits != 0 && build_fuse_filter(filename, set, fuse_bits, held_out, num_held_out, &result)) {
+        optimization_time += result.optimization_time;
+        #pragma omp critical
+        add_filter_result(fuse_totals, &result);
+    }
+    printf("\n");
+    free(held_out);
+    return optimization_time;
+}
+
+/*
+Function Description: combines 'count' words of the filters 'a' and 'b' into 'dest' with a
+bitwise OR (union) or, if 'intersect' is set, AND (intersection). The words are 64-byte
+aligned and 'count' is a multiple of 8, so with AVX2 (or SSE2) every step is an aligned
+256-bit (or 128-bit) load, op and store. 'dest' may be 'a'.
+*/
+void merge_words(uint64_t *dest, const uint64_t *a, const uint64_t *b, size_t count, int intersect) {
+#if defined(__AVX2__)
+    for (size_t w = 0; w < count; w += 4) {
+        __m256i x = _mm256_load_si256((const __m256i *)(a + w));
+        __m256i y = _mm256_load_si256((const __m256i *)(b + w));
+        _mm256_store_si256((__m256i *)(dest + w), intersect ? _mm256_and_si256(x, y) : _mm256_or_si256(x, y));
+    }
+#elif defined(__SSE2__)
+    for (size_t w = 0; w < count; w += 2) {
+        __m128i x = _mm_load_si128((const __m128i *)(a + w));
+        __m128i y = _mm_load_si128((const __m128i *)(b + w));
+        _mm_store_si128((__m128i *)(dest + w), intersect ? _mm_and_si128(x, y) : _mm_or_si128(x, y));
+    }
+#else
+    for (size_t w = 0; w < count; w++) {
+        dest[w] = intersect ? a[w] & b[w] : a[w] | b[w];
+    }
+#endif
+}
+
+/*
+Function Description: merges 'count' filters of the same kind, m and k into a new filter
+'result' by a tree reduction: the first level combines the inputs pairwise into new filters,
+and every further level combines pairs of those in place, halving their number, so there
+are log2(count) levels. The work of a level, every pair times every MERGE_CHUNK_WORDS-word
+chunk of the filter, is one OpenMP parallel for, so all threads are busy even at the top of
+the tree where only one pair is left. With 'intersect' unset the result is the union of the
+inputs: exactly the filter that inserting the words of all of them would have built. With
+it set the result is the intersection, which holds every word of all inputs but has a
+higher false positive rate than a filter built from the common words. Only bit filters can
+be merged this way; the counters of a counting filter would have to be added. Returns 1 on
+success, 0 if memory allocation has failed.
+*/
+int merge_filters(const struct bloom_filter *const *filters, int count, int intersect, struct bloom_filter *result) {
+    const struct bloom_filter *first = filters[0];
+    size_t num_words = first->num_words;
+    size_t num_chunks = (num_words + MERGE_CHUNK_WORDS - 1) / MERGE_CHUNK_WORDS;
+    int num_partial = (count + 1) / 2;
+    struct bloom_filter *partial = (struct bloom_filter *)calloc(num_partial, sizeof(struct bloom_filter));
+    int ok = partial != NULL;
+    for (int p = 0; ok && p < num_partial; p++) {
+        ok = bloom_filter_init(&partial[p], first->kind, first->m, first->k);
+    }
+    if (!ok) {
+        perror("Memory allocation has failed");
+        for (int p = 0; partial != NULL && p < num_partial; p++) {
+            free(partial[p].words);
+        }
+        free(partial);
+        return 0;
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (long item = 0; item < (long)num_partial * (long)num_chunks; item++) {
+        int p = (int)(item / num_chunks);
+        size_t start = (item % num_chunks) * MERGE_CHUNK_WORDS;
+        size_t words = num_words - start < MERGE_CHUNK_WORDS ? num_words - start : MERGE_CHUNK_WORDS;
+        if (2 * p + 1 < count) {
+            merge_words(partial[p].words + start, filters[2 * p]->words + start, filters[2 * p + 1]->words + start, words, intersect);
+        } else {
+            memcpy(partial[p].words + start, filters[2 * p]->words + start, words * sizeof(uint64_t));
+        }
+    }
+    for (int stride = 1; stride < num_partial; stride *= 2) {
+        // pairs (p, p + stride) for every p that is a multiple of 2 * stride
+        long num_pairs = (num_partial - stride + 2 * stride - 1) / (2 * stride);
+        #pragma omp parallel for schedule(static)
+        for (long item = 0; item < num_pairs * (long)num_chunks; item++) {
+            int p = (int)(item / num_chunks) * 2 * stride;
+            size_t start = (item % num_chunks) * MERGE_CHUNK_WORDS;
+            size_t words = num_words - start < MERGE_CHUNK_WORDS ? num_words - start : MERGE_CHUNK_WORDS;
+            merge_words(partial[p].words + start, partial[p].words + start, partial[p + stride].words + start, words, intersect);
+        }
+    }
+
+    *result = partial[0];
+    for (int p = 1; p < num_partial; p++) {
+        bloom_filter_free(&partial[p]);
+    }
+    free(partial);
+    return 1;
+}
+
+/*
+Function Description: the fraction of a bit filter's bits that are set. Because every
+probe of a word is an independent draw, the false positive rate of any filter, including a
+merged one whose word count is not known, is about fill^k.
+*/
+double bloom_filter_fill(const struct bloom_filter *filter) {
+    uint64_t set_bits = 0;
+    #pragma omp parallel for reduction(+:set_bits)
+    for (size_t w = 0; w < filter->num_words; w++) {
+        set_bits += __builtin_popcountll(filter->words[w]);
+    }
+    return (double)set_bits / filter->m;
+}
+
+/*
+Struct Description: one filter of a given kind shared by every thread of the run (global
+mode, -G), split into 'num_shards' independent shards. The first 'shard_bits' bits of a
+word's hash pick its shard, and the shard, an ordinary filter of m / num_shards bits with the
+filter's k, holds all k of its bits; its bit positions come from the rest of the hash, so the
+shards fill evenly and the false positive rate is that of one filter of m bits. Inserts set
+bits with the relaxed atomic fetch-or of the probe functions, so threads never take a lock.
+Every shard's words are a separate 64-byte aligned allocation of whole cache lines, so two
+shards never share a line, and the shards are zeroed by the threads of a parallel loop, so
+with first-touch page placement they are spread over the NUMA nodes of those threads instead
+of all landing on the node of the thread that allocated them.
+*/
+struct sharded_filter {
+    struct bloom_filter *shards;
+    int num_shards;
+    int shard_bits;
+    uint64_t m;
+    int k;
+    enum filter_kind kind;
+};
+
+/*
+Function Description: allocates a zeroed sharded filter of the given 'kind' with 'm' bits in
+total and 'k' bits per word. The number of shards follows the thread count: SHARDS_PER_THREAD
+per thread, rounded up to a power of two, so threads seldom insert into the same shard at
+once however small the filter is. Only a filter too small to give every shard a whole cache
+line (BLOCK_BITS positions) gets fewer. Returns 1 on success, 0 if memory allocation has
+failed.
+*/
+int sharded_filter_init(struct sharded_filter *filter, enum filter_kind kind, uint64_t m, int k) {
+    int shard_bits = 0;
+    while ((1 << shard_bits) < SHARDS_PER_THREAD * omp_get_max_threads() && (m >> (shard_bits + 1)) >= BLOCK_BITS) {
+        shard_bits++;
+    }
+    filter->kind = kind;
+    filter->m = m;
+    filter->k = k;
+    filter->shard_bits = shard_bits;
+    filter->num_shards = 1 << shard_bits;
+    filter->shards = (struct bloom_filter *)calloc(filter->num_shards, sizeof(struct bloom_filter));
+    if (filter->shards == NULL) {
+        return 0;
+    }
+    int ok = 1;
+    for (int s = 0; s < filter->num_shards && ok; s++) {
+        ok = bloom_filter_alloc(&filter->shards[s], kind, m >> shard_bits, k);
+    }
+    if (!ok) {
+        for (int s = 0; s < filter->num_shards; s++) {
+            free(filter->shards[s].words);
+        }
+        free(filter->shards);
+        filter->shards = NULL;
+        return 0;
+    }
+    // the first write to a page places it, so every shard is zeroed by the thread the loop gives it to
+    #pragma omp parallel for schedule(static)
+    for (int s = 0; s < filter->num_shards; s++) {
+        memset(filter->shards[s].words, 0, filter->shards[s].num_words * sizeof(uint64_t));
+    }
+    return 1;
+}
+
+void sharded_filter_free(struct sharded_filter *filter) {
+    for (int s = 0; filter->shards != NULL && s < filter->num_shards; s++) {
+        bloom_filter_free(&filter->shards[s]);
+    }
+    free(filter->shards);
+    filter->shards = NULL;
+}
+
+size_t sharded_filter_bytes(const struct sharded_filter *filter) {
+    return filter->num_shards * bloom_filter_bytes(&filter->shards[0]);
+}
+
+static inline struct bloom_filter *sharded_filter_shard(const struct sharded_filter *filter, uint64_t hash) {
+    return &filter->shards[filter->shard_bits > 0 ? hash >> (64 - filter->shard_bits) : 0];
+}
+
+/*
+Function Description: inserts the word with 64-bit 'hash' into its shard. Any number of
+threads can insert at once.
+*/
+void sharded_insert(const struct sharded_filter *filter, uint64_t hash) {
+    bloom_insert(sharded_filter_shard(filter, hash), hash);
+}
+
+int sharded_query(const struct sharded_filter *filter, uint64_t hash) {
+    return bloom_query(sharded_filter_shard(filter, hash), hash);
+}
+
+double sharded_filter_fill(const struct sharded_filter *filter) {
+    double fill = 0.0;
+    for (int s = 0; s < filter->num_shards; s++) {
+        fill += bloom_filter_fill(&filter->shards[s]);
+    }
+    return fill / filter->num_shards;
+}
+
+/*
+Function Description: the corpus mode. 'sets' holds the unique words of each of the
+'num_files' files (have_set[i] is 0 for a file that could not be read). Every filter is
+sized for all words of all files together (the sum of the per-file counts, an upper bound
+of the corpus vocabulary), so the filters of every file share one m and k per kind, as
+well as the hash seed, and can be merged. The per-file filters are built like in the
+default mode (in parallel over the files unless 'split_mode' is set), and the sets are freed.
+Then, for every selected bit kind, merge_filters combines them into a union filter ("is
+this word in any file") and an intersection filter ("is it in every file"), which are
+stored in kept_filters[num_files * NUM_FILTER_KINDS + kind] and kept_filters[(num_files + 1)
+* NUM_FILTER_KINDS + kind] and saved to save_dir/corpus.union.<kind>.bloom and
+corpus.intersection.<kind>.bloom if 'save_dir' is not NULL. Every word common to all files
+is looked up in the intersection filter to check it has none missing. Returns the time spent
+on optimization, insertion and merging.
+*/
+double build_corpus_filters(const char **filenames, int num_files, struct string_set *sets, const char *have_set,
+                            const int selected[NUM_FILTER_KINDS], const char *save_dir, int split_mode,
+                            struct bloom_filter *kept_filters, struct filter_result kind_totals[NUM_FILTER_KINDS],
+                            int fuse_bits, struct filter_result *fuse_totals) {
+    double start_time = omp_get_wtime();
+    int total_n = 0;
+    int smallest = -1;
+    for (int i = 0; i < num_files; i++) {
+        if (have_set[i]) {
+            total_n += sets[i].count;
+            if (smallest < 0 || sets[i].count < sets[smallest].count) {
+                smallest = i;
+            }
+        }
+    }
+    if (smallest < 0) {
+        return 0.0;
+    }
+    uint64_t common_m[NUM_FILTER_KINDS];
+    int common_k[NUM_FILTER_KINDS];
+    for (int kind = 0; kind < NUM_FILTER_KINDS; kind++) {
+        common_m[kind] = kind == FILTER_BLOCKED ? calc_blocked_bitArraySize(total_n, MAX_FP_RATE)
+                                                : calc_optimum_bitArraySize(total_n, MAX_FP_RATE);
+        common_k[kind] = calc_optimum_hash_functions(total_n, common_m[kind]);
+    }
+
+    // the words in every file are those of the smallest file that all others contain too
+    int num_common = 0;
+    uint64_t *common_hashes = (uint64_t *)malloc((sets[smallest].count + 1) * sizeof(uint64_t));
+    for (int w = 0; common_hashes != NULL && w < sets[smallest].count; w++) {
+        const struct string_entry *entry = &sets[smallest].entries[w];
+        int in_all = 1;
+        for (int i = 0; i < num_files && in_all; i++) {
+            in_all = !have_set[i] || i == smallest ||
+                     string_set_contains(&sets[i], sets[smallest].arena + entry->offset, entry->len);
+        }
+        if (in_all) {
+            common_hashes[num_common++] = entry->hash;
+        }
+    }
+
+    #pragma omp parallel for if(!split_mode)
+    for (int i = 0; i < num_files; i++) {
+        if (have_set[i]) {
+            build_file_filters(filenames[i], i, &sets[i], selected, common_m, common_k, save_dir, kept_filters, kind_totals,
+                               fuse_bits, fuse_totals);
+            string_set_free(&sets[i]);
+        }
+    }
+
+    uint64_t *held_out = (uint64_t *)malloc(FP_TEST_WORDS * sizeof(uint64_t));
+    const struct bloom_filter **inputs = (const struct bloom_filter **)malloc(num_files * sizeof(struct bloom_filter *));
+    if (held_out == NULL || inputs == NULL || common_hashes == NULL) {
+        perror("Memory allocation has failed");
+        free(held_out);
+        free(inputs);
+        free(common_hashes);
+        return omp_get_wtime() - start_time;
+    }
+    absent_word_hashes(held_out, FP_TEST_WORDS);
+    printf("Corpus filters: every file's filter was sized for all %d unique words of the %s\n", total_n,
+           "files together, so they share m and k and can be merged");
+    for (int kind = 0; kind < NUM_FILTER_KINDS; kind++) {
+        const char *name = filter_kind_names[kind];
+        int count = 0;
+        for (int i = 0; i < num_files; i++) {
+            if (kept_filters[i * NUM_FILTER_KINDS + kind].words != NULL) {
+                inputs[count++] = &kept_filters[i * NUM_FILTER_KINDS + kind];
+            }
+        }
+        if (count == 0) {
+            continue;
+        }
+        if (kind == FILTER_COUNTING) {
+            printf("[%s] counting filters are not merged, their counters would have to be added\n", name);
+            continue;
+        }
+        for (int intersect = 0; intersect <= 1; intersect++) {
+            const char *operation = intersect ? "intersection" : "union";
+            struct bloom_filter *merged = &kept_filters[(num_files + intersect) * NUM_FILTER_KINDS + kind];
+            double merge_start_time = omp_get_wtime();
+            if (!merge_filters(inputs, count, intersect, merged)) {
+                continue;
+            }
+            double merge_time = omp_get_wtime() - merge_start_time;
+            int false_positives = 0;
+            #pragma omp parallel for reduction(+:false_positives)
+            for (int t = 0; t < FP_TEST_WORDS; t++) {
+                false_positives += bloom_query(merged, held_out[t]);
+            }
+            double fill = bloom_filter_fill(merged);
+            printf("[%s] %s of %d filters: m = %llu bits, k = %d, merged in %lf seconds, %.1f%% of bits set\n", name,
+                   operation, count, (unsigned long long)merged->m, merged->k, merge_time, 100.0 * fill);
+            printf("[%s] %s False Positive Rate: %f (estimated from the fill, empirical, held-out words: %f)\n", name,
+                   operation, pow(fill, merged->k), (double)false_positives / FP_TEST_WORDS);
+            if (intersect) {
+                int found = 0;
+                #pragma omp parallel for reduction(+:found)
+                for (int w = 0; w < num_common; w++) {
+                    found += bloom_query(merged, common_hashes[w]);
+                }
+                printf("[%s] words in every file: %d, all reported present: %s\n", name, num_common,
+                       found == num_common ? "yes" : "NO");
+            }
+            if (save_dir != NULL) {
+                char save_path[4096];
+                snprintf(save_path, sizeof(save_path), "%s/corpus.%s.%s.bloom", save_dir, operation, name);
+                if (save_filter(merged, intersect ? num_common : total_n, save_path)) {
+                    printf("[%s] Saved the %s filter to %s\n", name, operation, save_path);
+                }
+            }
+        }
+    }
+    printf("\n");
+    free(held_out);
+    free(inputs);
+    free(common_hashes);
+    return omp_get_wtime() - start_time;
+}
+
+/*
+Function Description: the bytes a filter of the given 'kind' sized for the 'n' words of one
+file takes, so that the global filter can be compared with the per-file filters it replaces.
+*/
+size_t per_file_filter_bytes(enum filter_kind kind, int n) {
+    uint64_t m = kind == FILTER_BLOCKED ? calc_blocked_bitArraySize(n, MAX_FP_RATE) : calc_optimum_bitArraySize(n, MAX_FP_RATE);
+    return filter_num_words(kind, m) * sizeof(uint64_t);
+}
+
+/*
+Function Description: measures the false positive rate and the query throughput of a global
+'filter' sized for 'n' words with FP_TEST_WORDS held-out hashes, fills in the rest of
+'result' ('inserts' and 'insert_time' are set by the caller) and prints the filter's report:
+its size next to 'per_file_bytes', what the per-file filters would have taken, and whether
+the 'missing' words of the files it was checked against (-1 if it was not) were all found.
+*/
+void report_global_filter(const struct sharded_filter *filter, int n, const uint64_t *held_out, size_t per_file_bytes,
+                          int missing, struct filter_result *result) {
+    const char *name = filter_kind_names[filter->kind];
+    double start_query_time = omp_get_wtime();
+    int false_positives = 0;
+    #pragma omp parallel for reduction(+:false_positives)
+    for (int t = 0; t < FP_TEST_WORDS; t++) {
+        false_positives += sharded_query(filter, held_out[t]);
+    }
+    result->query_time = omp_get_wtime() - start_query_time;
+    result->m = filter->m;
+    result->filter_bytes = sharded_filter_bytes(filter);
+    result->unpacked_bytes = (size_t)filter->m * sizeof(int);
+    result->queries = FP_TEST_WORDS;
+    result->false_positives = false_positives;
+
+    printf("[%s] global: m = %llu bits in %d shards, k = %d, %zu bytes (per-file filters would use %zu)\n", name,
+           (unsigned long long)filter->m, filter->num_shards, filter->k, result->filter_bytes, per_file_bytes);
+    printf("[%s] global False Positive Rate: %f (empirical, held-out words: %f)\n", name,
+           filter->kind == FILTER_BLOCKED ? blocked_false_positive_rate(n, filter->m, filter->k)
+                                          : classic_false_positive_rate(n, filter->m, filter->k),
+           (double)false_positives / FP_TEST_WORDS);
+    if (filter->kind != FILTER_COUNTING) {
+        printf("[%s] global: %.1f%% of bits set\n", name, 100.0 * sharded_filter_fill(filter));
+    }
+    printf("[%s] global Throughput (million words/s): insert %f, query %f\n", name,
+           per_second(result->inserts, result->insert_time) / 1e6, per_second(FP_TEST_WORDS, result->query_time) / 1e6);
+    if (missing >= 0) {
+        printf("[%s] words of every file reported present: %s\n", name, missing == 0 ? "yes" : "NO");
+    }
+}
+
+int compare_hashes(const void *a, const void *b) {
+    uint64_t hash_a = *(const uint64_t *)a, hash_b = *(const uint64_t *)b;
+    return hash_a < hash_b ? -1 : hash_a > hash_b;
+}
+
+/*
+Function Description: counts the distinct words of all files together, the union of the
+'num_files' sets (have_set[i] is 0 for a file that could not be read). A word found in
+several files is counted once: the hashes the sets already hold are sorted and the distinct
+ones counted, so no word is compared or hashed again. Returns the count, or -1 if memory
+allocation has failed.
+*/
+int count_distinct_words(int num_files, const struct string_set *sets, const char *have_set) {
+    size_t total = 0;
+    for (int i = 0; i < num_files; i++) {
+        total += have_set[i] ? sets[i].count : 0;
+    }
+    uint64_t *hashes = (uint64_t *)malloc((total + 1) * sizeof(uint64_t));
+    if (hashes == NULL) {
+        return -1;
+    }
+    size_t filled = 0;
+    for (int i = 0; i < num_files; i++) {
+        for (int w = 0; have_set[i] && w < sets[i].count; w++) {
+            hashes[filled++] = sets[i].entries[w].hash;
+        }
+    }
+    qsort(hashes, total, sizeof(uint64_t), compare_hashes);
+    int distinct = 0;
+    for (size_t h = 0; h < total; h++) {
+        distinct += h == 0 || hashes[h] != hashes[h - 1];
+    }
+    free(hashes);
+    return distinct;
+}
+
+/*
+Function Description: the global mode (-G). 'sets' holds the unique words of each of the
+'num_files' files (have_set[i] is 0 for a file that could not be read). For every selected
+kind, one sharded filter (see struct sharded_filter) is sized for the distinct words of all
+files together (see count_distinct_words), so a word shared by several files is only paid
+for once, and every thread of the team
+inserts into it: the words of each file are split evenly over the threads, so the threads
+work on the same filter at the same time instead of each one on a filter of its own file.
+The filter is then checked to report every word of every file, its false positive rate is
+measured with held-out words, and its size is compared with what the per-file filters of
+the default mode would have taken together. The numbers are added to 'kind_totals' and the
+sets are freed. Returns the time spent on optimization and insertion.
+*/
+double build_global_filters(int num_files, struct string_set *sets, const char *have_set,
+                            const int selected[NUM_FILTER_KINDS], struct filter_result kind_totals[NUM_FILTER_KINDS]) {
+    double start_time = omp_get_wtime();
+    int total_n = 0;
+    for (int i = 0; i < num_files; i++) {
+        total_n += have_set[i] ? sets[i].count : 0;
+    }
+    int n = count_distinct_words(num_files, sets, have_set);
+    uint64_t *held_out = (uint64_t *)malloc(FP_TEST_WORDS * sizeof(uint64_t));
+    if (held_out == NULL || n < 0) {
+        perror("Memory allocation has failed");
+        free(held_out);
+        return 0.0;
+    }
+    absent_word_hashes(held_out, FP_TEST_WORDS);
+    printf("Global filters: one filter per kind for the %d distinct words of the files (%d summed over the files), "
+           "shared by %d threads\n", n, total_n, omp_get_max_threads());
+
+    for (int kind = 0; kind < NUM_FILTER_KINDS; kind++) {
+        if (!selected[kind]) {
+            continue;
+        }
+        struct filter_result result;
+        memset(&result, 0, sizeof(result));
+        double start_optimization_time = omp_get_wtime();
+        uint64_t m = kind == FILTER_BLOCKED ? calc_blocked_bitArraySize(n, MAX_FP_RATE)
+                                            : calc_optimum_bitArraySize(n, MAX_FP_RATE);
+        int k = calc_optimum_hash_functions(n, m);
+        struct sharded_filter filter;
+        if (!sharded_filter_init(&filter, kind, m, k)) {
+            perror("Memory allocation has failed");
+            continue;
+        }
+
+        double start_insert_time = omp_get_wtime();
+        #pragma omp parallel
+        {
+            struct thread_stats *thread = thread_stats();
+            double phase_start = instrument_start(thread);
+            uint64_t inserted = 0, hits = 0;
+            for (int i = 0; i < num_files; i++) {
+                int count = have_set[i] ? sets[i].count : 0;
+                #pragma omp for schedule(static) nowait
+                for (int w = 0; w < count; w++) {
+                    uint64_t hash = sets[i].entries[w].hash;
+                    if (thread != NULL) {
+                        hits += bloom_insert_counted(sharded_filter_shard(&filter, hash), hash);
+                        inserted++;
+                    } else {
+                        sharded_insert(&filter, hash);
+                    }
+                }
+            }
+            instrument_end(thread, PHASE_INSERT, phase_start);
+            instrument_count(thread, COUNT_PROBES, inserted * k);
+            instrument_count(thread, COUNT_BIT_HITS, hits);
+        }
+        result.insert_time = omp_get_wtime() - start_insert_time;
+        result.optimization_time = omp_get_wtime() - start_optimization_time;
+
+        int missing = 0;
+        for (int i = 0; i < num_files; i++) {
+            int count = have_set[i] ? sets[i].count : 0;
+            #pragma omp parallel for reduction(+:missing)
+            for (int w = 0; w < count; w++) {
+                missing += !sharded_query(&filter, sets[i].entries[w].hash);
+            }
+        }
+        size_t per_file_bytes = 0;
+        for (int i = 0; i < num_files; i++) {
+            per_file_bytes += have_set[i] ? per_file_filter_bytes(kind, sets[i].count) : 0;
+        }
+        result.unique_words = n;
+        result.inserts = total_n;
+        report_global_filter(&filter, n, held_out, per_file_bytes, missing, &result);
+        add_filter_result(&kind_totals[kind], &result);
+        sharded_filter_free(&filter);
+    }
+    printf("\n");
+    for (int i = 0; i < num_files; i++) {
+        if (have_set[i]) {
+            string_set_free(&sets[i]);
+        }
+    }
+    free(held_out);
+    return omp_get_wtime() - start_time;
+}
+
+/*
+Struct Description: a scalable bloom filter, for when the number of unique words is not known
+up front. It is a list of ordinary filters ('slices') of one kind. Only the newest slice
+takes inserts; once it holds its capacity of words, a new slice with SCALABLE_GROWTH times
+the capacity is added, sized for a false positive rate SCALABLE_TIGHTENING times that of the
+slice before. A word is in the filter if any slice holds it, so the overall false positive
+rate is at most the sum of the slice rates, a geometric series that starts at
+MAX_FP_RATE * (1 - SCALABLE_TIGHTENING) and so never exceeds MAX_FP_RATE however many slices
+are added. Memory grows with the words actually inserted, never with the corpus size.
+'counts[i]' is the number of words in slice i, and 'count' their total.
+*/
+struct scalable_filter {
+    struct bloom_filter slices[MAX_SLICES];
+    int counts[MAX_SLICES];
+    int num_slices;
+    int capacity;          // capacity of the newest slice
+    double fp_rate;        // target false positive rate of the newest slice
+    int count;
+    enum filter_kind kind;
+};
+
+/*
+Function Description: adds the next slice to a scalable filter. Past MAX_SLICES the newest
+slice simply keeps filling up (its false positive rate then rises above the bound), which
+only happens after a billion words. Returns 1 on success, 0 if memory allocation has failed.
+*/
+int scalable_filter_add_slice(struct scalable_filter *filter) {
+    if (filter->num_slices == MAX_SLICES) {
+        filter->capacity = INT_MAX;
+        return 1;
+    }
+    if (filter->num_slices > 0) {
+        filter->capacity *= SCALABLE_GROWTH;
+        filter->fp_rate *= SCALABLE_TIGHTENING;
+    }
+    int n = filter->capacity;
+    uint64_t m = filter->kind == FILTER_BLOCKED ? calc_blocked_bitArraySize(n, filter->fp_rate)
+                                                : calc_optimum_bitArraySize(n, filter->fp_rate);
+    if (!bloom_filter_init(&filter->slices[filter->num_slices], filter->kind, m, calc_optimum_hash_functions(n, m))) {
+        return 0;
+    }
+    filter->counts[filter->num_slices] = 0;
+    filter->num_slices++;
+    return 1;
+}
+
+int scalable_filter_init(struct scalable_filter *filter, enum filter_kind kind) {
+    filter->kind = kind;
+    filter->num_slices = 0;
+    filter->count = 0;
+    filter->capacity = SCALABLE_INITIAL_CAPACITY;
+    filter->fp_rate = MAX_FP_RATE * (1 - SCALABLE_TIGHTENING);
+    return scalable_filter_add_slice(filter);
+}
+
+void scalable_filter_free(struct scalable_filter *filter) {
+    for (int i = 0; i < filter->num_slices; i++) {
+        bloom_filter_free(&filter->slices[i]);
+    }
+    filter->num_slices = 0;
+}
+
+size_t scalable_filter_bytes(const struct scalable_filter *filter) {
+    size_t bytes = 0;
+    for (int i = 0; i < filter->num_slices; i++) {
+        bytes += bloom_filter_bytes(&filter->slices[i]);
+    }
+    return bytes;
+}
+
+uint64_t scalable_filter_positions(const struct scalable_filter *filter) {
+    uint64_t m = 0;
+    for (int i = 0; i < filter->num_slices; i++) {
+        m += filter->slices[i].m;
+    }
+    return m;
+}
+
+/*
+Function Description: returns 1 if any slice reports the word with 64-bit 'hash' as present.
+The oldest slice is checked first: the frequent words of a text show up early, so that is
+where most repeated tokens are found.
+*/
+int scalable_query(const struct scalable_filter *filter, uint64_t hash) {
+    for (int i = 0; i < filter->num_slices; i++) {
+        if (bloom_query(&filter->slices[i], hash)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+Function Description: inserts the word with 64-bit 'hash' unless the filter already reports
+it as present, so repeated words do not use up slice capacity and 'count' approximates the
+number of unique words (a false positive makes it miss a word now and then, which is why no
+exact set of words is needed). Returns 1 if the word was added, 0 if it was already
+present, and -1 if a new slice was needed and memory allocation has failed. A scalable
+filter belongs to one thread.
+*/
+int scalable_insert(struct scalable_filter *filter, uint64_t hash) {
+    if (scalable_query(filter, hash)) {
+        return 0;
+    }
+    int newest = filter->num_slices - 1;
+    bloom_insert(&filter->slices[newest], hash);
+    filter->counts[newest]++;
+    filter->count++;
+    if (filter->counts[newest] >= filter->capacity && !scalable_filter_add_slice(filter)) {
+        return -1;
+    }
+    return 1;
+}
+
+/*
+Function Description: the model false positive rate of a scalable filter as it is now filled:
+a word is a false positive unless every slice rejects it, 1 - prod(1 - rate of slice i).
+*/
+double scalable_false_positive_rate(const struct scalable_filter *filter) {
+    double all_reject = 1.0;
+    for (int i = 0; i < filter->num_slices; i++) {
+        const struct bloom_filter *slice = &filter->slices[i];
+        double rate = slice->kind == FILTER_BLOCKED ? blocked_false_positive_rate(filter->counts[i], slice->m, slice->k)
+                                                    : classic_false_positive_rate(filter->counts[i], slice->m, slice->k);
+        all_reject *= 1 - rate;
+    }
+    return 1 - all_reject;
+}
+
+/*
+Function Description: the streaming mode. Reads the file 'filename' in a single pass and
+inserts every token straight into one scalable filter per kind selected in 'selected'; no
+set of unique words is built, so memory is bounded by the filters instead of the vocabulary.
+Each token is hashed once for all filters. The false positive rate is then measured with
+the words of absent_word_hashes. Prints a report per filter, stores the approximate number of unique words of the
+file in 'unique_words', and returns the per-kind numbers in 'results'; 'total_strings',
+'bytes_read' and 'local_read_time' are filled in like read_strings_from_file does, with the
+read time covering the whole pass. Returns 1 on success, 0 on failure.
+*/
+int stream_file_into_filters(const char *filename, const int selected[NUM_FILTER_KINDS],
+                             struct filter_result results[NUM_FILTER_KINDS], int *unique_words,
+                             int *total_strings, size_t *bytes_read, double *local_read_time) {
+    double start_time = omp_get_wtime();
+    struct mapped_file file;
+    if (!map_file(filename, &file)) {
+        perror("There's an error opening this text file");
+        return 0;
+    }
+
+    struct scalable_filter filters[NUM_FILTER_KINDS];
+    int ok = 1;
+    for (int kind = 0; kind < NUM_FILTER_KINDS; kind++) {
+        filters[kind].num_slices = 0;
+        if (selected[kind] && !scalable_filter_init(&filters[kind], (enum filter_kind)kind)) {
+            ok = 0;
+        }
+    }
+
+    struct token_scanner scanner;
+    token_scanner_init(&scanner, file.data, file.size, 0);
+    const char *token;
+    size_t len;
+    while (ok && token_scanner_next(&scanner, &token, &len)) {
+        (*total_strings)++;
+        uint64_t hash = string_hash(token, len);
+        for (int kind = 0; kind < NUM_FILTER_KINDS; kind++) {
+            if (selected[kind] && scalable_insert(&filters[kind], hash) < 0) {
+                ok = 0;
+            }
+        }
+    }
+    *bytes_read += file.size;
+    instrument_count(thread_stats(), COUNT_BYTES_READ, file.size);
+    instrument_count(thread_stats(), COUNT_TOKENS, *total_strings);
+    unmap_file(&file);
+    double pass_time = omp_get_wtime() - start_time;
+    *local_read_time = pass_time;
+
+    uint64_t *held_out = (uint64_t *)malloc(FP_TEST_WORDS * sizeof(uint64_t));
+    if (!ok || held_out == NULL) {
+        perror("Memory allocation has failed");
+        ok = 0;
+    } else {
+        absent_word_hashes(held_out, FP_TEST_WORDS);
+    }
+
+    *unique_words = 0;
+    for (int kind = 0; kind < NUM_FILTER_KINDS; kind++) {
+        struct scalable_filter *filter = &filters[kind];
+        struct filter_result *result = &results[kind];
+        memset(result, 0, sizeof(*result));
+        if (!selected[kind] || !ok) {
+            scalable_filter_free(filter);
+            continue;
+        }
+        const char *name = filter_kind_names[kind];
+        double start_query_time = omp_get_wtime();
+        int false_positives = 0;
+        for (int t = 0; t < FP_TEST_WORDS; t++) {
+            false_positives += scalable_query(filter, held_out[t]);
+        }
+        result->query_time = omp_get_wtime() - start_query_time;
+        result->queries = FP_TEST_WORDS;
+        result->false_positives = false_positives;
+        result->m = scalable_filter_positions(filter);
+        result->filter_bytes = scalable_filter_bytes(filter);
+        result->unpacked_bytes = (size_t)result->m * sizeof(int);
+        result->unique_words = filter->count;
+        result->inserts = *total_strings;
+        result->insert_time = pass_time;
+        result->optimization_time = pass_time; // the single pass reads and inserts at once
+        if (*unique_words == 0) {
+            *unique_words = filter->count;
+        }
+
+        printf("[%s] %s: about %d unique words in %d slices, m = %llu bits, %zu bytes\n", name, filename,
+               filter->count, filter->num_slices, (unsigned long long)result->m, result->filter_bytes);
+        printf("[%s] False Positive Rate: %f (bound %f, empirical, held-out words: %f)\n", name,
+               scalable_false_positive_rate(filter), MAX_FP_RATE, (double)false_positives / FP_TEST_WORDS);
+        printf("[%s] Throughput (million words/s): streaming insert %f, query %f\n", name,
+               per_second(*total_strings, pass_time) / 1e6, per_second(FP_TEST_WORDS, result->query_time) / 1e6);
+        scalable_filter_free(filter);
+    }
+    free(held_out);
+    return ok;
+}
+
+/*
+Struct Description: a HyperLogLog sketch of a set of words (-E). The first HLL_PRECISION
+bits of a word's 64-bit hash pick one of HLL_REGISTERS registers, and the register keeps the
+largest "rank" seen there, the position of the first 1 bit in the rest of the hash. A
+register that has seen r distinct words holds about log2(r), so the registers together
+estimate the number of distinct words (see hll_estimate) with a standard error of
+1.04 / sqrt(HLL_REGISTERS), 0.8%, in HLL_REGISTERS bytes however many words there are.
+Adding a word twice changes nothing, and two sketches are merged by taking the larger value
+of every register, which gives exactly the sketch of the union of their words; so every
+thread can fill a sketch of its own, without sharing a cache line with the others, and the
+sketches are merged at the end.
+*/
+struct hll_sketch {
+    uint8_t registers[HLL_REGISTERS];
+};
+
+void hll_add(struct hll_sketch *sketch, uint64_t hash) {
+    // the sentinel bit caps the rank at 64 - HLL_PRECISION + 1 for an all-zero rest
+    uint64_t rest = (hash << HLL_PRECISION) | (1ULL << (HLL_PRECISION - 1));
+    uint8_t rank = (uint8_t)(__builtin_clzll(rest) + 1);
+    uint8_t *reg = &sketch->registers[hash >> (64 - HLL_PRECISION)];
+    if (rank > *reg) {
+        *reg = rank;
+    }
+}
+
+void hll_merge(struct hll_sketch *dest, const struct hll_sketch *src) {
+    for (int r = 0; r < HLL_REGISTERS; r++) {
+        dest->registers[r] = src->registers[r] > dest->registers[r] ? src->registers[r] : dest->registers[r];
+    }
+}
+
+/*
+Function Description: the HyperLogLog estimate of the number of distinct words added to
+'sketch': the normalized harmonic mean of 2^register. While many registers are still 0 (an
+estimate below 2.5 registers per word) linear counting over the empty registers is more
+accurate and is used instead. With 64-bit hashes no large-range correction is needed.
+*/
+double hll_estimate(const struct hll_sketch *sketch) {
+    double sum = 0.0;
+    int zeros = 0;
+    for (int r = 0; r < HLL_REGISTERS; r++) {
+        sum += ldexp(1.0, -sketch->registers[r]);
+        zeros += sketch->registers[r] == 0;
+    }
+    double alpha = 0.7213 / (1.0 + 1.079 / HLL_REGISTERS);
+    double estimate = alpha * HLL_REGISTERS * HLL_REGISTERS / sum;
+    if (estimate <= 2.5 * HLL_REGISTERS && zeros > 0) {
+        estimate = HLL_REGISTERS * log((double)HLL_REGISTERS / zeros);
+    }
+    return estimate;
+}
+
+/*
+Function Description: the number of words to size a filter for when its words are only known
+by their HyperLogLog 'estimate': the estimate plus a safety margin of HLL_MARGIN, about six
+standard errors, so the filter stays within MAX_FP_RATE even if the estimate is low.
+*/
+int hll_sizing_count(double estimate) {
+    return (int)ceil(estimate * (1.0 + HLL_MARGIN));
+}
+
+/*
+Struct Description: what the estimating mode (-E) has gathered over all files: the merged
+sketch of every file's words, the sum of the per-file estimates and, when the estimates are
+validated (-V), the sum of the exact per-file counts and the set of all words of all files
+(the exact count of the union). 'validate' is set by main(); the rest is updated by
+add_estimate inside a critical section, so files can finish in any order on any thread.
+*/
+struct estimate_totals {
+    struct hll_sketch sketch;
+    double estimated;
+    double exact;
+    struct string_set words;
+    int validate;
+};
+
+/*
+Function Description: counts the exact unique words of 'filename' for validating its
+estimate, and adds them to the set of all words in 'totals'. Returns the count, or -1 if the
+file could not be read.
+*/
+int exact_unique_words(const char *filename, struct estimate_totals *totals) {
+    struct string_set set;
+    int tokens = 0;
+    size_t bytes = 0;
+    double read_time = 0.0;
+    if (!read_strings_from_file(filename, &set, &tokens, &bytes, &read_time)) {
+        return -1;
+    }
+    int failed = 0;
+    #pragma omp critical(estimate_totals)
+    for (int w = 0; w < set.count && !failed; w++) {
+        const struct string_entry *entry = &set.entries[w];
+        failed = string_set_insert_hashed(&totals->words, set.arena + entry->offset, entry->len, entry->hash) < 0;
+    }
+    int count = set.count;
+    string_set_free(&set);
+    if (failed) {
+        perror("Memory allocation has failed");
+        return -1;
+    }
+    return count;
+}
+
+/*
+Function Description: adds the sketch and the estimate of one file to 'totals', and its
+'exact' count if it was validated (not -1), and prints the file's estimate, next to the
+exact count and the relative error when there is one.
+*/
+void add_estimate(struct estimate_totals *totals, const char *filename, const struct hll_sketch *sketch, double estimate,
+                  int exact) {
+    #pragma omp critical(estimate_totals)
+    {
+        hll_merge(&totals->sketch, sketch);
+        totals->estimated += estimate;
+        if (exact >= 0) {
+            totals->exact += exact;
+        }
+    }
+    if (exact >= 0) {
+        printf("[hll] %s: about %.0f unique words, exact %d (error %+.2f%%)\n", filename, estimate, exact,
+               exact > 0 ? 100.0 * (estimate - exact) / exact : 0.0);
+    } else {
+        printf("[hll] %s: about %.0f unique words, filters sized for %d\n", filename, estimate, hll_sizing_count(estimate));
+    }
+}
+
+/*
+Function Description: hashes every token that starts in the byte range ['start', 'end') of
+the mapped 'file' (a token crossing a range boundary belongs to the range it starts in, as
+in read_strings_from_range) and hands the hash on without deduplicating: it is added to
+'sketch' if that is not NULL, inserted into filters[kind] for every kind whose 'words' are
+set if 'filters' is not NULL, and into sharded[kind] for every kind whose 'shards' are set if
+'sharded' is not NULL. Returns the number of tokens.
+*/
+int hash_range(const struct mapped_file *file, size_t start, size_t end, struct hll_sketch *sketch,
+               struct bloom_filter *filters, const struct sharded_filter *sharded) {
+    struct thread_stats *stats = thread_stats();
+    double start_time = instrument_start(stats);
+    struct token_scanner scanner;
+    token_scanner_init(&scanner, file->data, file->size, start);
+    if (start > 0 && !isspace((unsigned char)file->data[start - 1])) {
+        token_scanner_seek(&scanner, 1);
+    }
+    const char *token;
+    size_t len;
+    int tokens = 0;
+    while (scanner.pos < end && token_scanner_next(&scanner, &token, &len) && token - file->data < (ptrdiff_t)end) {
+        uint64_t hash = string_hash(token, len);
+        tokens++;
+        if (sketch != NULL) {
+            hll_add(sketch, hash);
+        }
+        for (int kind = 0; kind < NUM_FILTER_KINDS; kind++) {
+            if (filters != NULL && filters[kind].words != NULL) {
+                bloom_insert(&filters[kind], hash);
+            }
+            if (sharded != NULL && sharded[kind].shards != NULL) {
+                sharded_insert(&sharded[kind], hash);
+            }
+        }
+    }
+    // the sketch pass reads the input, the insert pass inserts it
+    instrument_end(stats, sketch != NULL ? PHASE_TOKENIZE : PHASE_INSERT, start_time);
+    if (sketch != NULL) {
+        instrument_count(stats, COUNT_TOKENS, tokens);
+        instrument_count(stats, COUNT_BYTES_READ, end - start);
+    }
+    return tokens;
+}
+
+/*
+Function Description: the estimating mode (-E) for one file. Instead of deduplicating the
+file into a string set to learn how many unique words its filters need, a first pass over
+the mapped file fills a HyperLogLog sketch, the filters of every selected kind are sized for
+the estimate plus a safety margin (see hll_sizing_count), and a second pass inserts every
+token's hash straight into them. Inserting a word twice sets the same bits, so no
+deduplication is needed and the file's vocabulary is never held in memory. With 'split' both
+passes cut the file into one byte range per thread, each thread filling its own sketch
+(merged afterwards) and inserting into the shared filters with atomic ORs. The false
+positive rate is measured with held-out words. The file's estimate is added to 'totals' (and
+checked against the exact count with totals->validate, see exact_unique_words). Prints a
+report for the file and returns the numbers of every kind in 'results', the estimate in
+'estimated_words', and the tokens, bytes and time of the sketch pass in 'total_strings',
+'bytes_read' and 'local_read_time'. Returns 1 on success, 0 if the file could not be read or
+memory allocation has failed.
+*/
+int estimate_file_into_filters(const char *filename, const int selected[NUM_FILTER_KINDS], int split,
+                               struct estimate_totals *totals, struct filter_result results[NUM_FILTER_KINDS],
+                               double *estimated_words, int *total_strings, size_t *bytes_read, double *local_read_time) {
+    double start_time = omp_get_wtime();
+    struct mapped_file file;
+    if (!map_file(filename, &file)) {
+        perror("There's an error opening this text file");
+        return 0;
+    }
+    int num_threads = split ? omp_get_max_threads() : 1;
+    struct hll_sketch *sketches = (struct hll_sketch *)calloc(num_threads, sizeof(struct hll_sketch));
+    if (sketches == NULL) {
+        perror("Memory allocation has failed");
+        unmap_file(&file);
+        return 0;
+    }
+    int tokens = 0;
+    #pragma omp parallel num_threads(num_threads) reduction(+:tokens)
+    {
+        int t = omp_get_thread_num();
+        int team_size = omp_get_num_threads();
+        size_t start = file.size * t / team_size;
+        size_t end = file.size * (t + 1) / team_size;
+        tokens += start < end ? hash_range(&file, start, end, &sketches[t], NULL, NULL) : 0;
+    }
+    for (int t = 1; t < num_threads; t++) {
+        hll_merge(&sketches[0], &sketches[t]);
+    }
+    double estimate = hll_estimate(&sketches[0]);
+    int n = hll_sizing_count(estimate);
+    *total_strings += tokens;
+    *bytes_read += file.size;
+    *local_read_time = omp_get_wtime() - start_time;
+    *estimated_words = estimate;
+
+    struct bloom_filter filters[NUM_FILTER_KINDS];
+    int ok = 1;
+    double start_insert_time = omp_get_wtime();
+    for (int kind = 0; kind < NUM_FILTER_KINDS; kind++) {
+        filters[kind].words = NULL;
+        if (selected[kind] && ok) {
+            uint64_t m = kind == FILTER_BLOCKED ? calc_blocked_bitArraySize(n, MAX_FP_RATE)
+                                                : calc_optimum_bitArraySize(n, MAX_FP_RATE);
+            ok = bloom_filter_init(&filters[kind], kind, m, calc_optimum_hash_functions(n, m));
+        }
+    }
+    if (ok) {
+        #pragma omp parallel num_threads(num_threads)
+        {
+            int t = omp_get_thread_num();
+            int team_size = omp_get_num_threads();
+            size_t start = file.size * t / team_size;
+            size_t end = file.size * (t + 1) / team_size;
+            if (start < end) {
+                hash_range(&file, start, end, NULL, filters, NULL);
+            }
+        }
+    }
+    double insert_time = omp_get_wtime() - start_insert_time;
+    unmap_file(&file);
+
+    int num_held_out = (int)fmin(fmax(10.0 * estimate, FP_TEST_MIN_WORDS), FP_TEST_WORDS);
+    uint64_t *held_out = (uint64_t *)malloc(num_held_out * sizeof(uint64_t));
+    if (!ok || held_out == NULL) {
+        perror("Memory allocation has failed");
+        ok = 0;
+    } else {
+        absent_word_hashes(held_out, num_held_out);
+        int exact = totals->validate ? exact_unique_words(filename, totals) : -1;
+        add_estimate(totals, filename, &sketches[0], estimate, exact);
+    }
+
+    for (int kind = 0; kind < NUM_FILTER_KINDS; kind++) {
+        struct bloom_filter *filter = &filters[kind];
+        struct filter_result *result = &results[kind];
+        memset(result, 0, sizeof(*result));
+        if (filter->words == NULL) {
+            continue;
+        }
+        if (ok) {
+            const char *name = filter_kind_names[kind];
+            double start_query_time = omp_get_wtime();
+            int false_positives = 0;
+            for (int t = 0; t < num_held_out; t++) {
+                false_positives += bloom_query(filter, held_out[t]);
+            }
+            result->query_time = omp_get_wtime() - start_query_time;
+            result->queries = num_held_out;
+            result->false_positives = false_positives;
+            result->m = filter->m;
+            result->filter_bytes = bloom_filter_bytes(filter);
+            result->unpacked_bytes = (size_t)filter->m * sizeof(int);
+            result->unique_words = estimate;
+            result->inserts = tokens;
+            result->insert_time = insert_time;
+            result->optimization_time = insert_time;
+
+            printf("[%s] %s: m = %llu bits, k = %d, %zu bytes, sized for %d words\n", name, filename,
+                   (unsigned long long)filter->m, filter->k, result->filter_bytes, n);
+            printf("[%s] False Positive Rate: %f (empirical, held-out words: %f)\n", name,
+                   kind == FILTER_BLOCKED ? blocked_false_positive_rate((int)estimate, filter->m, filter->k)
+                                          : classic_false_positive_rate((int)estimate, filter->m, filter->k),
+                   (double)false_positives / num_held_out);
+            printf("[%s] Throughput (million words/s): insert without dedup %f, query %f\n", name,
+                   per_second(tokens, insert_time) / 1e6, per_second(num_held_out, result->query_time) / 1e6);
+        }
+        bloom_filter_free(filter);
+    }
+    free(held_out);
+    free(sketches);
+    return ok;
+}
+
+/*
+Function Description: the estimating mode (-E) combined with the global mode (-G), which
+never holds a vocabulary at all. Every readable file of 'filenames' is mapped and cut into
+chunks of TASK_BATCH_BYTES, and all threads take chunks of all files in turn, dynamically
+scheduled, in two passes. The first pass fills a sketch per chunk and merges it into its
+file's sketch, giving the per-file estimates, whose merge is the estimate for all files
+together. One sharded filter per selected kind is sized for that estimate plus the margin
+(see hll_sizing_count), and the second pass inserts every token's hash into them. With
+totals->validate the exact per-file and overall counts are taken as well, and every word of
+every file is looked up in the filters to check that none is missing. The numbers are added
+to 'kind_totals', the tokens, bytes and time of the sketch pass to 'total_tokens',
+'bytes_read' and 'read_time'. Returns the time spent on sizing and insertion.
+*/
+double build_global_estimated_filters(const char **filenames, int num_files, const int selected[NUM_FILTER_KINDS],
+                                      struct estimate_totals *totals, struct filter_result kind_totals[NUM_FILTER_KINDS],
+                                      double *total_tokens, size_t *bytes_read, double *read_time) {
+    double start_time = omp_get_wtime();
+    struct mapped_file *files = (struct mapped_file *)calloc(num_files, sizeof(struct mapped_file));
+    struct hll_sketch *file_sketches = (struct hll_sketch *)calloc(num_files, sizeof(struct hll_sketch));
+    uint64_t *held_out = (uint64_t *)malloc(FP_TEST_WORDS * sizeof(uint64_t));
+    char *readable = (char *)calloc(num_files, 1);
+    int num_chunks = 0;
+    for (int i = 0; files != NULL && readable != NULL && i < num_files; i++) {
+        readable[i] = map_file(filenames[i], &files[i]);
+        if (!readable[i]) {
+            perror("There's an error opening this text file");
+            printf("Error reading strings from the text file %s\n", filenames[i]);
+            files[i].size = 0;
+        }
+        num_chunks += (int)((files[i].size + TASK_BATCH_BYTES - 1) / TASK_BATCH_BYTES);
+    }
+    int *chunk_file = (int *)malloc((num_chunks + 1) * sizeof(int));
+    size_t *chunk_start = (size_t *)malloc((num_chunks + 1) * sizeof(size_t));
+    if (files == NULL || file_sketches == NULL || held_out == NULL || readable == NULL || chunk_file == NULL ||
+        chunk_start == NULL) {
+        perror("Memory allocation has failed");
+        for (int i = 0; files != NULL && i < num_files; i++) {
+            unmap_file(&files[i]);
+        }
+        free(files);
+        free(file_sketches);
+        free(held_out);
+        free(readable);
+        free(chunk_file);
+        free(chunk_start);
+        return 0.0;
+    }
+    num_chunks = 0;
+    for (int i = 0; i < num_files; i++) {
+        for (size_t start = 0; start < files[i].size; start += TASK_BATCH_BYTES) {
+            chunk_file[num_chunks] = i;
+            chunk_start[num_chunks++] = start;
+        }
+    }
+
+    int tokens = 0;
+    #pragma omp parallel reduction(+:tokens)
+    {
+        struct hll_sketch *chunk_sketch = (struct hll_sketch *)malloc(sizeof(struct hll_sketch));
+        #pragma omp for schedule(dynamic)
+        for (int c = 0; c < num_chunks; c++) {
+            const struct mapped_file *file = &files[chunk_file[c]];
+            size_t end = chunk_start[c] + TASK_BATCH_BYTES < file->size ? chunk_start[c] + TASK_BATCH_BYTES : file->size;
+            if (chunk_sketch != NULL) {
+                memset(chunk_sketch, 0, sizeof(*chunk_sketch));
+                tokens += hash_range(file, chunk_start[c], end, chunk_sketch, NULL, NULL);
+                #pragma omp critical(file_sketches)
+                hll_merge(&file_sketches[chunk_file[c]], chunk_sketch);
+            }
+        }
+        free(chunk_sketch);
+    }
+    *total_tokens += tokens;
+    for (int i = 0; i < num_files; i++) {
+        *bytes_read += files[i].size;
+    }
+    *read_time += omp_get_wtime() - start_time;
+
+    size_t per_file_bytes[NUM_FILTER_KINDS] = {0};
+    for (int i = 0; i < num_files; i++) {
+        if (!readable[i]) {
+            continue;
+        }
+        double estimate = hll_estimate(&file_sketches[i]);
+        int exact = totals->validate ? exact_unique_words(filenames[i], totals) : -1;
+        add_estimate(totals, filenames[i], &file_sketches[i], estimate, exact);
+        for (int kind = 0; kind < NUM_FILTER_KINDS; kind++) {
+            per_file_bytes[kind] += selected[kind] ? per_file_filter_bytes(kind, hll_sizing_count(estimate)) : 0;
+        }
+    }
+    double estimate = hll_estimate(&totals->sketch);
+    int n = hll_sizing_count(estimate);
+    printf("Global filters: one filter per kind for about %.0f unique words of the files (sized for %d), shared by %d threads\n",
+           estimate, n, omp_get_max_threads());
+
+    double insert_start_time = omp_get_wtime();
+    struct sharded_filter filters[NUM_FILTER_KINDS];
+    for (int kind = 0; kind < NUM_FILTER_KINDS; kind++) {
+        filters[kind].shards = NULL;
+        if (selected[kind]) {
+            uint64_t m = kind == FILTER_BLOCKED ? calc_blocked_bitArraySize(n, MAX_FP_RATE)
+                                                : calc_optimum_bitArraySize(n, MAX_FP_RATE);
+            if (!sharded_filter_init(&filters[kind], kind, m, calc_optimum_hash_functions(n, m))) {
+                perror("Memory allocation has failed");
+            }
+        }
+    }
+    #pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < num_chunks; c++) {
+        const struct mapped_file *file = &files[chunk_file[c]];
+        size_t end = chunk_start[c] + TASK_BATCH_BYTES < file->size ? chunk_start[c] + TASK_BATCH_BYTES : file->size;
+        hash_range(file, chunk_start[c], end, NULL, NULL, filters);
+    }
+    double insert_time = omp_get_wtime() - insert_start_time;
+    for (int i = 0; i < num_files; i++) {
+        unmap_file(&files[i]);
+    }
+
+    absent_word_hashes(held_out, FP_TEST_WORDS);
+    for (int kind = 0; kind < NUM_FILTER_KINDS; kind++) {
+        struct sharded_filter *filter = &filters[kind];
+        if (filter->shards == NULL) {
+            continue;
+        }
+        int missing = -1;
+        if (totals->validate) {
+            missing = 0;
+            #pragma omp parallel for reduction(+:missing)
+            for (int w = 0; w < totals->words.count; w++) {
+                missing += !sharded_query(filter, totals->words.entries[w].hash);
+            }
+        }
+        struct filter_result result;
+        memset(&result, 0, sizeof(result));
+        result.unique_words = estimate;
+        result.inserts = tokens;
+        result.insert_time = insert_time;
+        result.optimization_time = insert_time;
+        report_global_filter(filter, (int)estimate, held_out, per_file_bytes[kind], missing, &result);
+        add_filter_result(&kind_totals[kind], &result);
+        sharded_filter_free(filter);
+    }
+    printf("\n");
+    free(files);
+    free(file_sketches);
+    free(held_out);
+    free(readable);
+    free(chunk_file);
+    free(chunk_start);
+    return insert_time;
+}
+
+/*
+Struct Description: the unit of work of the pipelined ingest (see run_pipeline): up to
+TOKEN_BATCH tokens of file number 'file', as views into its mapping, with a hash slot per
+token that the hasher stage fills in. A batch with 'end_of_file' set carries no tokens; it
+tells the file's inserter that the reader cut the file into 'total_batches' batches, and
+whether reading it 'failed'. A batch
+with 'file' set to -1 tells the stage that receives it to stop.
+*/
+struct token_batch {
+    int file;
+    int count;
+    int end_of_file;
+    int total_batches;
+    int failed;            // set on an end-of-file batch if the reader could not read the whole file
+    const char *tokens[TOKEN_BATCH];
+    uint32_t lengths[TOKEN_BATCH];
+    uint64_t hashes[TOKEN_BATCH];
+};
+
+/*
+Struct Description: a bounded multi-producer, multi-consumer queue of batch pointers that
+uses no locks (Vyukov's bounded queue). Every cell has a sequence number that says whether
+it is ready to be written (sequence == position) or read (sequence == position + 1) by the
+thread that claims that position with a compare-and-swap, so producers and consumers only
+contend on their own end of the ring. The two ends live on separate cache lines.
+*/
+struct queue_cell {
+    size_t sequence;
+    struct token_batch *batch;
+};
+
+struct batch_queue {
+    struct queue_cell cells[PIPELINE_QUEUE_SIZE];
+    size_t enqueue_pos __attribute__((aligned(64)));
+    size_t dequeue_pos __attribute__((aligned(64)));
+};
+
+void batch_queue_init(struct batch_queue *queue) {
+    for (size_t i = 0; i < PIPELINE_QUEUE_SIZE; i++) {
+        queue->cells[i].sequence = i;
+    }
+    queue->enqueue_pos = 0;
+    queue->dequeue_pos = 0;
+}
+
+int batch_queue_try_push(struct batch_queue *queue, struct token_batch *batch) {
+    size_t pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+    struct queue_cell *cell;
+    for (;;) {
+        cell = &queue->cells[pos % PIPELINE_QUEUE_SIZE];
+        size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&queue->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return 0; // full
+        } else {
+            pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    cell->batch = batch;
+    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+struct token_batch *batch_queue_try_pop(struct batch_queue *queue) {
+    size_t pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+    struct queue_cell *cell;
+    for (;;) {
+        cell = &queue->cells[pos % PIPELINE_QUEUE_SIZE];
+        size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)(pos + 1);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&queue->dequeue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return NULL; // empty
+        } else {
+            pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    struct token_batch *batch = cell->batch;
+    __atomic_store_n(&cell->sequence, pos + PIPELINE_QUEUE_SIZE, __ATOMIC_RELEASE);
+    return batch;
+}
+
+size_t batch_queue_occupancy(const struct batch_queue *queue) {
+    size_t tail = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+    size_t head = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+    return tail > head ? tail - head : 0;
+}
+
+/*
+Struct Description: what one pipeline thread did: the time it spent working ('busy') and
+waiting on a full output queue or an empty input queue, the batches it handled, and the
+occupancy of the queue it pushed to, sampled at every push. Every thread fills its own
+copy, so collecting the numbers costs no synchronization.
+*/
+struct stage_stats {
+    double busy;
+    double waiting;
+    long batches;
+    double occupancy_sum;
+    long occupancy_samples;
+    size_t occupancy_max;
+};
+
+/*
+Function Description: pushes 'batch' to 'queue', yielding the processor while the queue is
+full; the time spent waiting is added to 'stats', and the queue's occupancy is sampled.
+*/
+void pipeline_push(struct batch_queue *queue, struct token_batch *batch, struct stage_stats *stats) {
+    size_t occupancy = batch_queue_occupancy(queue);
+    stats->occupancy_sum += occupancy;
+    stats->occupancy_samples++;
+    if (occupancy > stats->occupancy_max) {
+        stats->occupancy_max = occupancy;
+    }
+    if (batch_queue_try_push(queue, batch)) {
+        return;
+    }
+    double start_time = omp_get_wtime();
+    while (!batch_queue_try_push(queue, batch)) {
+        sched_yield();
+    }
+    stats->waiting += omp_get_wtime() - start_time;
+}
+
+struct token_batch *pipeline_pop(struct batch_queue *queue, struct stage_stats *stats) {
+    struct token_batch *batch = batch_queue_try_pop(queue);
+    if (batch != NULL) {
+        return batch;
+    }
+    double start_time = omp_get_wtime();
+    while ((batch = batch_queue_try_pop(queue)) == NULL) {
+        sched_yield();
+    }
+    stats->waiting += omp_get_wtime() - start_time;
+    return batch;
+}
+
+struct token_batch *new_token_batch(int file) {
+    struct token_batch *batch = (struct token_batch *)malloc(sizeof(struct token_batch));
+    if (batch != NULL) {
+        batch->file = file;
+        batch->count = 0;
+        batch->end_of_file = 0;
+        batch->total_batches = 0;
+        batch->failed = 0;
+    }
+    return batch;
+}
+
+/*
+Struct Description: the state of one input file in the pipeline. The reader that claims the
+file writes 'file'; everything else belongs to the file's inserter, which is the only thread
+that receives the file's batches. The queues order those accesses: a batch
+is pushed after the mapping is stored and popped before it is used.
+*/
+struct pipeline_file {
+    struct mapped_file file;
+    struct string_set set;
+    int failed;
+    int started;
+    int batches_seen;
+    int total_batches;     // -1 until the end-of-file batch has arrived
+    int tokens;
+};
+
+/*
+Function Description: the reader stage. Claims files one at a time, maps them, and cuts their
+tokens into batches for the hashers; faulting the pages in is the disk I/O of the pipeline,
+and it overlaps with the hashing and inserting of the batches already queued. Every file
+ends with an end-of-file batch, also when it could not be read. The last reader to finish
+sends every hasher a stop batch.
+*/
+void pipeline_reader(const char **filenames, int num_files, struct pipeline_file *files, int *next_file,
+                     int *readers_left, int num_hashers, struct batch_queue *token_queue, struct stage_stats *stats) {
+    double busy_start = omp_get_wtime();
+    double waited = stats->waiting;
+    int f;
+    while ((f = __atomic_fetch_add(next_file, 1, __ATOMIC_RELAXED)) < num_files) {
+        struct pipeline_file *input = &files[f];
+        int num_batches = 0;
+        int failed = 0;
+        if (!map_file(filenames[f], &input->file)) {
+            perror("There's an error opening this text file");
+            failed = 1;
+        } else {
+            madvise((void *)input->file.data, input->file.size, MADV_SEQUENTIAL);
+            struct token_scanner scanner;
+            token_scanner_init(&scanner, input->file.data, input->file.size, 0);
+            const char *token;
+            size_t len;
+            struct token_batch *batch = NULL;
+            while (token_scanner_next(&scanner, &token, &len)) {
+                if (batch == NULL && (batch = new_token_batch(f)) == NULL) {
+                    perror("Memory allocation has failed");
+                    failed = 1;
+                    break;
+                }
+                batch->tokens[batch->count] = token;
+                batch->lengths[batch->count] = (uint32_t)len;
+                if (++batch->count == TOKEN_BATCH) {
+                    pipeline_push(token_queue, batch, stats);
+                    stats->batches++;
+                    num_batches++;
+                    batch = NULL;
+                }
+            }
+            if (batch != NULL) {
+                pipeline_push(token_queue, batch, stats);
+                stats->batches++;
+                num_batches++;
+            }
+        }
+        struct token_batch *end = new_token_batch(f);
+        while (end == NULL) { // the inserter cannot finish the file without it
+            sched_yield();
+            end = new_token_batch(f);
+        }
+        end->end_of_file = 1;
+        end->total_batches = num_batches;
+        end->failed = failed;
+        pipeline_push(token_queue, end, stats);
+    }
+    if (__atomic_sub_fetch(readers_left, 1, __ATOMIC_ACQ_REL) == 0) {
+        for (int h = 0; h < num_hashers; h++) {
+            struct token_batch *stop = new_token_batch(-1);
+            while (stop == NULL) {
+                sched_yield();
+                stop = new_token_batch(-1);
+            }
+            pipeline_push(token_queue, stop, stats);
+        }
+    }
+    stats->busy += omp_get_wtime() - busy_start - (stats->waiting - waited);
+}
+
+/*
+Function Description: the hasher stage. Hashes every token of a batch once (the hash is what
+both the set of unique words and the filter's probe indices are derived from) and passes the
+batch on to the inserter that owns its file, file % num_inserters. The last hasher to stop
+sends every inserter a stop batch.
+*/
+void pipeline_hasher(struct batch_queue *token_queue, struct batch_queue *insert_queues, int num_inserters,
+                     int *hashers_left, struct stage_stats *stats) {
+    double busy_start = omp_get_wtime();
+    double waited = stats->waiting;
+    struct token_batch *batch;
+    while ((batch = pipeline_pop(token_queue, stats))->file >= 0) {
+        for (int t = 0; t < batch->count; t++) {
+            batch->hashes[t] = string_hash(batch->tokens[t], batch->lengths[t]);
+        }
+        stats->batches += !batch->end_of_file;
+        pipeline_push(&insert_queues[batch->file % num_inserters], batch, stats);
+    }
+    free(batch);
+    if (__atomic_sub_fetch(hashers_left, 1, __ATOMIC_ACQ_REL) == 0) {
+        for (int i = 0; i < num_inserters; i++) {
+            struct token_batch *stop = new_token_batch(-1);
+            while (stop == NULL) {
+                sched_yield();
+                stop = new_token_batch(-1);
+            }
+            pipeline_push(&insert_queues[i], stop, stats);
+        }
+    }
+    stats->busy += omp_get_wtime() - busy_start - (stats->waiting - waited);
+}
+
+/*
+Struct Description: the settings and results of run_pipeline that are shared by its threads:
+where finished files' filters go (as for build_file_filters), and the totals of the run,
+which the inserters add to atomically.
+*/
+struct pipeline_output {
+    const int *selected;
+    const char *save_dir;
+    struct bloom_filter *kept_filters;
+    struct filter_result *kind_totals;
+    int fuse_bits;
+    struct filter_result *fuse_totals;
+    int unique_words;
+    double tokens;
+    size_t bytes_read;
+    double read_time;      // time the readers were busy
+    double optimization_time;
+};
+
+/*
+Function Description: the inserter stage. Adds the hashed tokens of every batch to the set of
+unique words of its file (string_set_insert_hashed, so no token is hashed twice). Each file
+has exactly one inserter, so the sets need no locks. Once all batches of a file have arrived
+the file is unmapped and its filters are built right away with build_file_filters, while
+the readers and hashers keep working on the files after it.
+*/
+void pipeline_inserter(const char **filenames, struct pipeline_file *files, struct batch_queue *insert_queue,
+                       struct pipeline_output *output, struct stage_stats *stats) {
+    double busy_start = omp_get_wtime();
+    double waited = stats->waiting;
+    struct token_batch *batch;
+    while ((batch = pipeline_pop(insert_queue, stats))->file >= 0) {
+        int f = batch->file;
+        struct pipeline_file *input = &files[f];
+        if (!input->started) {
+            string_set_init(&input->set);
+            input->started = 1;
+            input->total_batches = -1;
+        }
+        if (batch->end_of_file) {
+            input->total_batches = batch->total_batches;
+            input->failed |= batch->failed;
+        } else {
+            for (int t = 0; t < batch->count && !input->failed; t++) {
+                if (string_set_insert_hashed(&input->set, batch->tokens[t], batch->lengths[t], batch->hashes[t]) < 0) {
+                    perror("Memory allocation has failed");
+                    input->failed = 1;
+                }
+            }
+            input->tokens += batch->count;
+            input->batches_seen++;
+            stats->batches++;
+        }
+        free(batch);
+        if (input->batches_seen != input->total_batches) {
+            continue;
+        }
+
+        // every batch of the file is in: its set is complete
+        size_t file_size = input->file.size;
+        unmap_file(&input->file);
+        if (input->failed) {
+            printf("Error reading strings from the text file %s\n", filenames[f]);
+        } else {
+            double optimization_time = build_file_filters(filenames[f], f, &input->set, output->selected, NULL, NULL,
+                                                          output->save_dir, output->kept_filters, output->kind_totals,
+                                                          output->fuse_bits, output->fuse_totals);
+            #pragma omp atomic
+            output->unique_words += input->set.count;
+            #pragma omp atomic
+            output->optimization_time += optimization_time;
+        }
+        #pragma omp atomic
+        output->tokens += input->tokens;
+        #pragma omp atomic
+        output->bytes_read += file_size;
+        string_set_free(&input->set);
+    }
+    free(batch);
+    stats->busy += omp_get_wtime() - busy_start - (stats->waiting - waited);
+}
+
+/*
+Function Description: the pipelined ingest. Instead of one thread per file reading, then
+deduplicating, then building its filters strictly one after another, the work is split into
+three stages that run at the same time on their own threads, 'stage_threads' = {readers,
+hashers, inserters}, connected by bounded lock-free queues of token batches (one queue into
+the hashers, one per inserter out of them). While a reader waits for the disk the hashers
+and inserters work on earlier batches, so on cold-cache runs the I/O is hidden behind the
+compute. Finished files' filters are built by their inserter (see pipeline_inserter). Prints
+per-stage busy and waiting times and the average and peak occupancy of the queue each stage
+pushes to, which show the stage that limits the pipeline: its input queue runs full and its
+threads never wait. Returns 1 on success, 0 if the threads or memory could not be had.
+*/
+int run_pipeline(const char **filenames, int num_files, const int stage_threads[3], struct pipeline_output *output) {
+    static const char *stage_names[3] = {"reader", "hasher", "inserter"};
+    int num_readers = stage_threads[0], num_hashers = stage_threads[1], num_inserters = stage_threads[2];
+    int num_threads = num_readers + num_hashers + num_inserters;
+    struct pipeline_file *files = (struct pipeline_file *)calloc(num_files, sizeof(struct pipeline_file));
+    struct batch_queue *queues = (struct batch_queue *)aligned_alloc(64, (1 + num_inserters) * sizeof(struct batch_queue));
+    struct stage_stats *stats = (struct stage_stats *)calloc(num_threads, sizeof(struct stage_stats));
+    if (files == NULL || queues == NULL || stats == NULL) {
+        perror("Memory allocation has failed");
+        free(files);
+        free(queues);
+        free(stats);
+        return 0;
+    }
+    for (int q = 0; q < 1 + num_inserters; q++) {
+        batch_queue_init(&queues[q]);
+    }
+    int next_file = 0, readers_left = num_readers, hashers_left = num_hashers;
+    int team_size = 0;
+
+    // every stage thread spins on its queues, so the team must be exactly as large as requested;
+    // the caller's dynamic adjustment setting is put back as soon as the team has finished
+    int was_dynamic = omp_get_dynamic();
+    omp_set_dynamic(0);
+    #pragma omp parallel num_threads(num_threads)
+    {
+        #pragma omp single
+        team_size = omp_get_num_threads();
+        // the implicit barrier of single makes team_size visible to every thread
+        int t = omp_get_thread_num();
+        if (team_size == num_threads) {
+            if (t < num_readers) {
+                pipeline_reader(filenames, num_files, files, &next_file, &readers_left, num_hashers, &queues[0], &stats[t]);
+            } else if (t < num_readers + num_hashers) {
+                pipeline_hasher(&queues[0], &queues[1], num_inserters, &hashers_left, &stats[t]);
+            } else {
+                pipeline_inserter(filenames, files, &queues[1 + (t - num_readers - num_hashers)], output, &stats[t]);
+            }
+        }
+    }
+    omp_set_dynamic(was_dynamic);
+    if (team_size != num_threads) {
+        fprintf(stderr, "The pipeline needs %d threads but only got %d\n", num_threads, team_size);
+    } else {
+        int first = 0;
+        for (int stage = 0; stage < 3; stage++) {
+            struct stage_stats total;
+            memset(&total, 0, sizeof(total));
+            for (int t = first; t < first + stage_threads[stage]; t++) {
+                total.busy += stats[t].busy;
+                total.waiting += stats[t].waiting;
+                total.batches += stats[t].batches;
+                total.occupancy_sum += stats[t].occupancy_sum;
+                total.occupancy_samples += stats[t].occupancy_samples;
+                if (stats[t].occupancy_max > total.occupancy_max) {
+                    total.occupancy_max = stats[t].occupancy_max;
+                }
+            }
+            first += stage_threads[stage];
+            if (stage == 0) {
+                output->read_time = total.busy;
+            }
+            printf("Pipeline %s stage: %d threads, %ld batches, busy %lf s, waiting %lf s (%.1f%% busy)",
+                   stage_names[stage], stage_threads[stage], total.batches, total.busy, total.waiting,
+                   total.busy + total.waiting > 0 ? 100.0 * total.busy / (total.busy + total.waiting) : 0.0);
+            if (stage < 2) {
+                printf(", output queue occupancy avg %.1f max %zu of %d",
+                       total.occupancy_samples > 0 ? total.occupancy_sum / total.occupancy_samples : 0.0,
+                       total.occupancy_max, PIPELINE_QUEUE_SIZE);
+            }
+            printf("\n");
+        }
+        printf("\n");
+    }
+    free(files);
+    free(queues);
+    free(stats);
+    return team_size == num_threads;
+}
+
+/*
+Function Description: prints the results of looking up every word of 'queries' in
+'num_filters' filters as a table with one row per query word and one 0/1 column per filter,
+headed by 'labels'. 'results' holds the result of word q in filter f at f * queries->count
++ q, and a filter with a NULL label is left out.
+*/
+void print_query_table(const char *const *labels, int num_filters, const struct query_set *queries,
+                       const unsigned char *results) {
+    printf("query");
+    for (int f = 0; f < num_filters; f++) {
+        if (labels[f] != NULL) {
+            printf("\t%s", labels[f]);
+        }
+    }
+    printf("\n");
+    for (int q = 0; q < queries->count; q++) {
+        printf("%.*s", (int)queries->lengths[q], queries->words[q]);
+        for (int f = 0; f < num_filters; f++) {
+            if (labels[f] != NULL) {
+                printf("\t%d", results[(size_t)f * queries->count + q]);
+            }
+        }
+        printf("\n");
+    }
+    printf("\n");
+}
+
+/*
+Function Description: the batch query mode. Every query word is hashed once, then looked up
+in every filter of 'filters' that holds words (a NULL 'words' marks a filter that was not
+built, and its label is NULL) in prefetched batches spread over all threads. The results
+are printed by print_query_table after all lookups are done. The number of lookups and the time they took are added to 'total_queries'
+and 'total_query_time'. Returns 1 on success, 0 if memory allocation has failed.
+*/
+int run_batch_queries(const struct bloom_filter *filters, const char *const *labels, int num_filters,
+                      struct query_set *queries, double *total_queries, double *total_query_time) {
+    unsigned char *results = (unsigned char *)calloc((size_t)num_filters * queries->count + 1, 1);
+    if (results == NULL) {
+        perror("Memory allocation has failed");
+        return 0;
+    }
+    double start_query_time = omp_get_wtime();
+    hash_query_set(queries);
+    for (int f = 0; f < num_filters; f++) {
+        if (filters[f].words != NULL) {
+            query_filter(&filters[f], queries, results + (size_t)f * queries->count);
+            *total_queries += queries->count;
+        }
+    }
+    *total_query_time += omp_get_wtime() - start_query_time;
+
+    print_query_table(labels, num_filters, queries, results);
+    free(results);
+    return 1;
+}
+
+/*
+Struct Description: the binary protocol of the query daemon (-S). A client sends requests over
+a Unix domain socket and gets one response per request, in order. Every message is a
+'daemon_header' followed by 'size' bytes of body; all fields are in native byte order, as
+both ends run on the same machine.
+
+- DAEMON_OP_INFO: no body. The response's 'count' is the number of filters served, and its
+  body holds, for each of them, a 'daemon_filter_info' followed by 'label_len' bytes of label.
+  Requests name a filter by its position in this list.
+- DAEMON_OP_QUERY: 'filter' is the filter to look the words up in, and the body holds 'count'
+  words, each a uint16_t length followed by that many bytes. The response's body is a bitmap
+  of (count + 7) / 8 bytes where bit i (bit i % 8 of byte i / 8) is set if word i may be
+  present.
+
+In a response 'op' is a daemon_status instead of an operation. A request whose body is larger
+than DAEMON_MAX_REQUEST closes the connection.
+*/
+enum daemon_op {
+    DAEMON_OP_INFO = 1,
+    DAEMON_OP_QUERY = 2
+};
+
+enum daemon_status {
+    DAEMON_OK = 0,
+    DAEMON_BAD_REQUEST = 1,
+    DAEMON_NO_FILTER = 2
+};
+
+struct daemon_header {
+    uint32_t size;
+    uint16_t op;
+    uint16_t filter;
+    uint32_t count;
+};
+
+struct daemon_filter_info {
+    uint64_t m;
+    uint8_t kind;
+    uint8_t k;
+    uint16_t label_len;
+    uint32_t reserved;
+};
+
+/*
+Struct Description: the state of the daemon and of one client connection. The filters are
+only read while serving, so every worker thread answers from the same copy without any
+locking. A connection is registered with EPOLLONESHOT, so only the one worker that received
+its event touches it until that worker re-arms it: its buffers need no locking either, and
+its responses go out in the order of its requests. 'out' holds the responses of the
+connection from 'out_sent' up to 'out_used' that the client has not taken yet.
+*/
+struct daemon {
+    const struct bloom_filter *filters;
+    const char *const *labels;
+    int *served;
+    int num_served;
+    int epoll_fd;
+    int listen_fd;
+    int stop_fd;
+};
+
+struct daemon_connection {
+    int fd;
+    unsigned char *in;
+    size_t in_used;
+    size_t in_capacity;
+    unsigned char *out;
+    size_t out_used;
+    size_t out_sent;
+    size_t out_capacity;
+    uint64_t *hashes;
+    unsigned char *results;
+    size_t scratch_words;
+};
+
+/*
+the signal handler only writes to an eventfd that every worker's epoll set watches, which is
+async-signal-safe and wakes all workers at once
+*/
+int daemon_stop_fd = -1;
+
+void daemon_signal_handler(int signal_number) {
+    uint64_t one = 1;
+    (void)signal_number;
+    if (write(daemon_stop_fd, &one, sizeof(one)) < 0) {
+        // nothing can be done about it inside a signal handler
+    }
+}
+
+/*
+Function Description: grows the buffer '*buffer' of '*capacity' bytes geometrically until it
+holds at least 'needed' bytes. Returns 1 on success, 0 if memory allocation has failed.
+*/
+int grow_buffer(unsigned char **buffer, size_t *capacity, size_t needed) {
+    if (needed <= *capacity) {
+        return 1;
+    }
+    size_t grown_capacity = *capacity ? *capacity : 4096;
+    while (grown_capacity < needed) {
+        grown_capacity *= 2;
+    }
+    unsigned char *grown = (unsigned char *)realloc(*buffer, grown_capacity);
+    if (grown == NULL) {
+        return 0;
+    }
+    *buffer = grown;
+    *capacity = grown_capacity;
+    return 1;
+}
+
+/*
+Function Description: writes all 'size' bytes of 'data' to the (blocking) socket 'fd'.
+Returns 1 on success, 0 if the connection failed.
+*/
+int socket_write_all(int fd, const void *data, size_t size) {
+    const unsigned char *p = (const unsigned char *)data;
+    while (size > 0) {
+        ssize_t written = send(fd, p, size, MSG_NOSIGNAL);
+        if (written > 0) {
+            p += written;
+            size -= written;
+        } else if (written < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+Function Description: reads exactly 'size' bytes from the (blocking) socket 'fd'. Returns 1
+on success, 0 if the connection failed or was closed first.
+*/
+int socket_read_all(int fd, void *data, size_t size) {
+    unsigned char *p = (unsigned char *)data;
+    while (size > 0) {
+        ssize_t got = read(fd, p, size);
+        if (got > 0) {
+            p += got;
+            size -= got;
+        } else if (got < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+Function Description: hashes the 'request->count' words of a query request's 'body' and looks
+them up in the requested filter, writing one result byte per word to the connection's
+'results'. The words are looked up in prefetched batches of QUERY_BATCH (see
+bloom_query_batch), exactly like the batch query mode does. Returns DAEMON_OK, or
+DAEMON_BAD_REQUEST if the body does not hold 'count' words, or -1 if memory allocation has
+failed.
+*/
+int daemon_query(const struct daemon *daemon, struct daemon_connection *connection,
+                 const struct daemon_header *request, const unsigned char *body) {
+    // every word takes at least its two length bytes, which bounds 'count' by the body size
+    if (request->count > request->size / sizeof(uint16_t)) {
+        return DAEMON_BAD_REQUEST;
+    }
+    if (request->count > connection->scratch_words) {
+        uint64_t *hashes = (uint64_t *)realloc(connection->hashes, request->count * sizeof(uint64_t));
+        if (hashes != NULL) {
+            connection->hashes = hashes;
+        }
+        unsigned char *results = (unsigned char *)realloc(connection->results, request->count);
+        if (results != NULL) {
+            connection->results = results;
+        }
+        if (hashes == NULL || results == NULL) {
+            return -1;
+        }
+        connection->scratch_words = request->count;
+    }
+    size_t pos = 0;
+    for (uint32_t i = 0; i < request->count; i++) {
+        uint16_t len;
+        if (pos + sizeof(len) > request->size) {
+            return DAEMON_BAD_REQUEST;
+        }
+        memcpy(&len, body + pos, sizeof(len));
+        pos += sizeof(len);
+        if (pos + len > request->size) {
+            return DAEMON_BAD_REQUEST;
+        }
+        connection->hashes[i] = string_hash((const char *)body + pos, len);
+        pos += len;
+    }
+    const struct bloom_filter *filter = &daemon->filters[daemon->served[request->filter]];
+    for (uint32_t first = 0; first < request->count; first += QUERY_BATCH) {
+        int count = request->count - first < QUERY_BATCH ? (int)(request->count - first) : QUERY_BATCH;
+        bloom_query_batch(filter, connection->hashes + first, count, connection->results + first);
+    }
+    return DAEMON_OK;
+}
+
+/*
+Function Description: answers one request, 'request' with its 'body', by appending the
+response to the connection's pending output. Returns 1 on success, 0 if memory allocation
+has failed.
+*/
+int daemon_answer(const struct daemon *daemon, struct daemon_connection *connection,
+                  const struct daemon_header *request, const unsigned char *body) {
+    struct daemon_header response = {0, DAEMON_OK, request->filter, 0};
+    size_t start = connection->out_used;
+    size_t size = start + sizeof(response);
+    if (!grow_buffer(&connection->out, &connection->out_capacity, size)) {
+        return 0;
+    }
+
+    if (request->op == DAEMON_OP_INFO) {
+        response.count = daemon->num_served;
+        for (int s = 0; s < daemon->num_served; s++) {
+            const struct bloom_filter *filter = &daemon->filters[daemon->served[s]];
+            const char *label = daemon->labels[daemon->served[s]];
+            struct daemon_filter_info info = {filter->m, (uint8_t)filter->kind, (uint8_t)filter->k, 0, 0};
+            info.label_len = (uint16_t)(strlen(label) < UINT16_MAX ? strlen(label) : UINT16_MAX);
+            if (!grow_buffer(&connection->out, &connection->out_capacity, size + sizeof(info) + info.label_len)) {
+                return 0;
+            }
+            memcpy(connection->out + size, &info, sizeof(info));
+            memcpy(connection->out + size + sizeof(info), label, info.label_len);
+            size += sizeof(info) + info.label_len;
+        }
+    } else if (request->op != DAEMON_OP_QUERY) {
+        response.op = DAEMON_BAD_REQUEST;
+    } else if (request->filter >= daemon->num_served) {
+        response.op = DAEMON_NO_FILTER;
+    } else {
+        int status = daemon_query(daemon, connection, request, body);
+        size_t bitmap_size = (request->count + 7) / 8;
+        if (status < 0 || !grow_buffer(&connection->out, &connection->out_capacity, size + bitmap_size)) {
+            return 0;
+        }
+        response.op = (uint16_t)status;
+        if (status == DAEMON_OK) {
+            memset(connection->out + size, 0, bitmap_size);
+            for (uint32_t i = 0; i < request->count; i++) {
+                connection->out[size + i / 8] |= connection->results[i] << (i % 8);
+            }
+            response.count = request->count;
+            size += bitmap_size;
+        }
+    }
+    response.size = (uint32_t)(size - start - sizeof(response));
+    memcpy(connection->out + start, &response, sizeof(response));
+    connection->out_used = size;
+    return 1;
+}
+
+/*
+Function Description: sends as much of the connection's pending output as its socket takes
+without blocking. Returns 1 once all of it has been sent, 0 if the rest has to wait until the
+socket is writable again, or -1 if the connection failed.
+*/
+int daemon_flush(struct daemon_connection *connection) {
+    while (connection->out_sent < connection->out_used) {
+        ssize_t written = send(connection->fd, connection->out + connection->out_sent,
+                               connection->out_used - connection->out_sent, MSG_NOSIGNAL);
+        if (written > 0) {
+            connection->out_sent += written;
+        } else if (written < 0 && errno == EINTR) {
+            continue;
+        } else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        } else {
+            return -1;
+        }
+    }
+    connection->out_used = 0;
+    connection->out_sent = 0;
+    return 1;
+}
+
+/*
+Function Description: reads everything the client of 'connection' has sent so far and answers
+every complete request in it, keeping a partial request for the next event. The responses
+are sent without blocking; whatever the client does not take stays pending, and nothing more
+is read until it has all been sent, so a client that stops reading holds neither a worker
+nor more than one read's worth of responses. Likewise at most one read's worth of bytes
+beyond a complete request is buffered, so a client that pipelines many requests cannot make
+the input buffer grow without bound. 'requests' and 'words' are increased by the requests
+and query words answered. Returns the epoll events to re-arm the connection with (EPOLLOUT
+while output is pending, EPOLLIN otherwise), or 0 if it was closed by the client or has to
+be closed.
+*/
+uint32_t daemon_serve_connection(const struct daemon *daemon, struct daemon_connection *connection,
+                                 long *requests, long *words) {
+    for (;;) {
+        int drained = daemon_flush(connection);
+        if (drained < 0) {
+            return 0;
+        }
+        if (!drained) {
+            // no EPOLLRDHUP here: a client that has shut down its sending side would otherwise
+            // wake a worker over and over until it reads its responses
+            return EPOLLOUT;
+        }
+        if (!grow_buffer(&connection->in, &connection->in_capacity, connection->in_used + 65536)) {
+            return 0;
+        }
+        ssize_t got = read(connection->fd, connection->in + connection->in_used, connection->in_capacity - connection->in_used);
+        if (got == 0) {
+            return 0;
+        }
+        if (got < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? EPOLLIN | EPOLLRDHUP : 0;
+        }
+        connection->in_used += got;
+
+        size_t pos = 0;
+        while (connection->in_used - pos >= sizeof(struct daemon_header)) {
+            struct daemon_header request;
+            memcpy(&request, connection->in + pos, sizeof(request));
+            if (request.size > DAEMON_MAX_REQUEST) {
+                return 0;
+            }
+            if (connection->in_used - pos < sizeof(request) + request.size) {
+                break;
+            }
+            if (!daemon_answer(daemon, connection, &request, connection->in + pos + sizeof(request))) {
+                return 0;
+            }
+            (*requests)++;
+            *words += request.op == DAEMON_OP_QUERY ? request.count : 0;
+            pos += sizeof(request) + request.size;
+        }
+        memmove(connection->in, connection->in + pos, connection->in_used - pos);
+        connection->in_used -= pos;
+    }
+}
+
+void daemon_close_connection(struct daemon_connection *connection) {
+    close(connection->fd);
+    free(connection->in);
+    free(connection->out);
+    free(connection->hashes);
+    free(connection->results);
+    free(connection);
+}
+
+/*
+Function Description: accepts every pending client of the daemon's listening socket and adds
+it to the epoll set. Returns the number of clients accepted.
+*/
+long daemon_accept(const struct daemon *daemon) {
+    long accepted = 0;
+    int fd;
+    while ((fd = accept(daemon->listen_fd, NULL, NULL)) >= 0) {
+        struct daemon_connection *connection = (struct daemon_connection *)calloc(1, sizeof(struct daemon_connection));
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        event.data.ptr = connection;
+        if (connection == NULL || fcntl(fd, F_SETFL, O_NONBLOCK) != 0) {
+            free(connection);
+            close(fd);
+            continue;
+        }
+        connection->fd = fd;
+        if (epoll_ctl(daemon->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            daemon_close_connection(connection);
+            continue;
+        }
+        accepted++;
+    }
+    return accepted;
+}
+
+/*
+Function Description: the loop every worker thread of the daemon runs. All workers wait on
+the same epoll set, which holds the listening socket, every client connection and the stop
+eventfd. The listening socket and the connections are one-shot, so each event goes to
+exactly one worker, which accepts the new clients or answers the connection's requests and
+then re-arms it, for reading or, while the client has not taken all of its responses yet,
+for writing. The stop eventfd is level-triggered and never read, so once it is signalled
+every worker sees it and returns. The worker's counts are added to 'requests', 'words' and
+'connections'.
+*/
+void daemon_worker(const struct daemon *daemon, long *requests, long *words, long *connections) {
+    for (;;) {
+        struct epoll_event event;
+        int ready = epoll_wait(daemon->epoll_fd, &event, 1, -1);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready < 0 || event.data.ptr == &daemon->stop_fd) {
+            return;
+        }
+        if (event.data.ptr == &daemon->listen_fd) {
+            *connections += daemon_accept(daemon);
+            event.events = EPOLLIN | EPOLLONESHOT;
+            epoll_ctl(daemon->epoll_fd, EPOLL_CTL_MOD, daemon->listen_fd, &event);
+            continue;
+        }
+        struct daemon_connection *connection = (struct daemon_connection *)event.data.ptr;
+        event.events = daemon_serve_connection(daemon, connection, requests, words);
+        if (event.events == 0) {
+            daemon_close_connection(connection);
+            continue;
+        }
+        event.events |= EPOLLONESHOT;
+        if (epoll_ctl(daemon->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event) != 0) {
+            daemon_close_connection(connection);
+        }
+    }
+}
+
+/*
+Function Description: the daemon mode (-S). Serves the 'num_filters' filters of 'filters'
+that hold words, labelled 'labels', on the Unix domain socket 'socket_path' until the process
+gets SIGINT or SIGTERM, with one worker per OpenMP thread (see daemon_worker). The filters
+are built or loaded once, before this is called, so a lookup costs a round trip on the socket
+instead of a whole run of the program. A stale socket file left at 'socket_path' is
+replaced. Returns 1 on success, 0 if the daemon could not be started.
+*/
+int run_daemon(const struct bloom_filter *filters, const char *const *labels, int num_filters, const char *socket_path) {
+    struct daemon daemon;
+    memset(&daemon, 0, sizeof(daemon));
+    daemon.filters = filters;
+    daemon.labels = labels;
+    daemon.served = (int *)malloc((num_filters + 1) * sizeof(int));
+    if (daemon.served == NULL) {
+        perror("Memory allocation has failed");
+        return 0;
+    }
+    for (int f = 0; f < num_filters; f++) {
+        if (filters[f].words != NULL) {
+            daemon.served[daemon.num_served++] = f;
+        }
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "The socket path %s is too long\n", socket_path);
+        free(daemon.served);
+        return 0;
+    }
+    strcpy(address.sun_path, socket_path);
+    unlink(socket_path);
+    daemon.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    daemon.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    daemon.stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event listen_event = {EPOLLIN | EPOLLONESHOT, {.ptr = &daemon.listen_fd}};
+    struct epoll_event stop_event = {EPOLLIN, {.ptr = &daemon.stop_fd}};
+    if (daemon.listen_fd < 0 || daemon.epoll_fd < 0 || daemon.stop_fd < 0 ||
+        bind(daemon.listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(daemon.listen_fd, SOMAXCONN) != 0 ||
+        epoll_ctl(daemon.epoll_fd, EPOLL_CTL_ADD, daemon.listen_fd, &listen_event) != 0 ||
+        epoll_ctl(daemon.epoll_fd, EPOLL_CTL_ADD, daemon.stop_fd, &stop_event) != 0) {
+        perror("There's an error starting the query daemon");
+        close(daemon.listen_fd);
+        close(daemon.epoll_fd);
+        close(daemon.stop_fd);
+        free(daemon.served);
+        return 0;
+    }
+
+    struct sigaction action, old_interrupt, old_terminate;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = daemon_signal_handler;
+    sigemptyset(&action.sa_mask);
+    daemon_stop_fd = daemon.stop_fd;
+    sigaction(SIGINT, &action, &old_interrupt);
+    sigaction(SIGTERM, &action, &old_terminate);
 
-    while (current_false_positive_rate > max_fp_rate) {
-        m++;
-        current_false_positive_rate = pow(1 - pow(1 - (1.0 / m), k * n), k);
+    printf("Serving %d filters on %s with %d worker threads (SIGINT or SIGTERM stops)\n",
+           daemon.num_served, socket_path, omp_get_max_threads());
+    for (int s = 0; s < daemon.num_served; s++) {
+        printf("  filter %d: %s\n", s, labels[daemon.served[s]]);
     }
-    return (int)(-n * log(max_fp_rate) / ((log(2) * log(2))));
+    fflush(stdout);
+
+    double start_time = omp_get_wtime();
+    long requests = 0, words = 0, connections = 0;
+    #pragma omp parallel reduction(+:requests, words, connections)
+    daemon_worker(&daemon, &requests, &words, &connections);
+    double serve_time = omp_get_wtime() - start_time;
+
+    sigaction(SIGINT, &old_interrupt, NULL);
+    sigaction(SIGTERM, &old_terminate, NULL);
+    daemon_stop_fd = -1;
+    close(daemon.listen_fd);
+    unlink(socket_path);
+    close(daemon.epoll_fd);
+    close(daemon.stop_fd);
+    free(daemon.served);
+    printf("Daemon stopped after %lf seconds: %ld connections, %ld requests, %ld words looked up\n\n",
+           serve_time, connections, requests, words);
+    return 1;
 }
 
 /*
-Function Description: The division method hash is used to hash each  unique word 
-before inserting the value into the bloom filter. It will initialize a 'hash'
-variable to zero and iterates through the chracacters in the word. Through this
-process, each ASCII Values of the characters in the word are summed up, then it
-will me modulo-ed to fit the result within the range of the bit array size.
+Function Description: sends 'size' bytes of request in 'buffer' (header included) to the
+daemon on 'fd' and reads the response header into 'response' and its body into 'buffer'.
+Returns 1 if the daemon answered with DAEMON_OK, 0 otherwise.
 */
-int division_method_hash(const char *word, int m) {
-    unsigned long hash = 0;
-    size_t len = strlen(word);
-    for (int i = 0; i < len; i++) {
-        hash += (unsigned long)word[i];
+int daemon_round_trip(int fd, unsigned char **buffer, size_t *capacity, size_t size, struct daemon_header *response) {
+    return socket_write_all(fd, *buffer, size) && socket_read_all(fd, response, sizeof(*response)) &&
+           response->op == DAEMON_OK && grow_buffer(buffer, capacity, response->size) &&
+           socket_read_all(fd, *buffer, response->size);
+}
+
+void free_labels(char **labels, int num_labels) {
+    for (int f = 0; f < num_labels; f++) {
+        free(labels[f]);
     }
-    return (int)(hash % m);
+    free(labels);
 }
 
 /*
-Function Description: checks if a given 'string' exists within an array of strings
-'strings_arr' up to a specific number of strings 'num_strings' that needs to be 
-checked. It comparses the strings each string to check for potential duplications.
-If its a duplicate: 1, if not 0.
+Function Description: asks the daemon on 'fd' which filters it serves and returns their
+labels through 'labels' (one malloc'ed string each, in the daemon's order) and their number
+through 'num_filters'. Returns 1 on success, 0 on failure.
 */
-int duplicated_strings(const char *string, char **strings_arr, int num_strings) {
-    for (int i = 0; i < num_strings; i++) {
-        if (strcmp(strings_arr[i], string) == 0) {
-            return 1;
+int daemon_client_info(int fd, unsigned char **buffer, size_t *capacity, char ***labels, int *num_filters) {
+    struct daemon_header request = {0, DAEMON_OP_INFO, 0, 0};
+    struct daemon_header response;
+    if (!grow_buffer(buffer, capacity, sizeof(request))) {
+        perror("Memory allocation has failed");
+        return 0;
+    }
+    memcpy(*buffer, &request, sizeof(request));
+    if (!daemon_round_trip(fd, buffer, capacity, sizeof(request), &response)) {
+        fprintf(stderr, "The query daemon did not answer the info request\n");
+        return 0;
+    }
+    // every entry takes at least its fixed part, so a count that cannot fit is rejected up front
+    if (response.count > response.size / sizeof(struct daemon_filter_info)) {
+        fprintf(stderr, "The query daemon sent a malformed info reply\n");
+        return 0;
+    }
+    *labels = (char **)calloc(response.count + 1, sizeof(char *));
+    if (*labels == NULL) {
+        perror("Memory allocation has failed");
+        return 0;
+    }
+    int ok = 1;
+    size_t pos = 0;
+    int f;
+    for (f = 0; f < (int)response.count; f++) {
+        struct daemon_filter_info info;
+        if (pos + sizeof(info) > response.size) {
+            fprintf(stderr, "The query daemon sent a malformed info reply\n");
+            ok = 0;
+            break;
+        }
+        memcpy(&info, *buffer + pos, sizeof(info));
+        if (pos + sizeof(info) + info.label_len > response.size) {
+            fprintf(stderr, "The query daemon sent a malformed info reply\n");
+            ok = 0;
+            break;
+        }
+        (*labels)[f] = (char *)malloc(info.label_len + 1);
+        if ((*labels)[f] == NULL) {
+            perror("Memory allocation has failed");
+            ok = 0;
+            break;
         }
+        memcpy((*labels)[f], *buffer + pos + sizeof(info), info.label_len);
+        (*labels)[f][info.label_len] = '\0';
+        pos += sizeof(info) + info.label_len;
     }
-    return 0;
+    if (!ok) {
+        free_labels(*labels, f);
+        *labels = NULL;
+        return 0;
+    }
+    *num_filters = (int)response.count;
+    return 1;
 }
 
 /*
-Function Description: Reads strings from text file specified by a 'filename' and stores 
-unique words in a dynamically allocated array. It also keeps track of the number of strings
-read 'num_strings', the total number of strings read across the file 'total_strings', and 
-the total time taken for reading_and counting the unique words 'total_read_time'. While 
-reading from the file using fscanf, it checks if the read strings is duplicated using the
-duplicated_strings function. If the string's nont a duplicate, it dynamically allocates
-memory for the new string and adds it to the strings_arr. 
-
-***strings_arr: creates an array of strings, where each string is a pointer to an array of
-characters. Used to pass address of the array of strings between functions so that the array
-can be dynamically allocated and modified.
-*/
-int read_strings_from_file(const char *filename, char ***strings_arr, int *num_strings, int *total_strings, double *local_read_time) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
-        perror("There's an error opening this text file");
+Function Description: looks up the 'count' query words starting at 'first' in the daemon's
+filter number 'filter' with one query request, and writes one result byte per word to
+'results'. Returns 1 on success, 0 on failure.
+*/
+int daemon_client_query(int fd, unsigned char **buffer, size_t *capacity, int filter,
+                        const struct query_set *queries, int first, int count, unsigned char *results) {
+    struct daemon_header request = {0, DAEMON_OP_QUERY, (uint16_t)filter, (uint32_t)count};
+    struct daemon_header response;
+    size_t size = sizeof(request);
+    for (int q = first; q < first + count; q++) {
+        uint16_t len = (uint16_t)queries->lengths[q]; // run_daemon_client has rejected longer words
+        if (!grow_buffer(buffer, capacity, size + sizeof(len) + len)) {
+            perror("Memory allocation has failed");
+            return 0;
+        }
+        memcpy(*buffer + size, &len, sizeof(len));
+        memcpy(*buffer + size + sizeof(len), queries->words[q], len);
+        size += sizeof(len) + len;
+    }
+    request.size = (uint32_t)(size - sizeof(request));
+    if (!grow_buffer(buffer, capacity, sizeof(request))) {
+        perror("Memory allocation has failed");
+        return 0;
+    }
+    memcpy(*buffer, &request, sizeof(request));
+    if (!daemon_round_trip(fd, buffer, capacity, size, &response) || response.count != (uint32_t)count) {
+        fprintf(stderr, "The query daemon failed a query request (status %d)\n", response.op);
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        results[i] = ((*buffer)[i / 8] >> (i % 8)) & 1;
+    }
+    return 1;
+}
+
+/*
+Function Description: the daemon client mode (-C). Connects to the daemon listening on
+'socket_path', asks it which filters it serves, and looks up every word of 'queries' in every
+one of them, in requests of DAEMON_CLIENT_BATCH words sent one at a time. Prints the same
+table as the batch query mode, followed by the throughput and the round trip latency of the
+requests (and "metric" lines if 'print_metrics' is set). A word longer than UINT16_MAX bytes
+does not fit the protocol's length field; rather than looking up a truncated word, the client
+reports it and sends nothing. Returns 1 on success, 0 on failure.
+*/
+int run_daemon_client(const char *socket_path, const struct query_set *queries, int print_metrics) {
+    for (int q = 0; q < queries->count; q++) {
+        if (queries->lengths[q] > UINT16_MAX) {
+            fprintf(stderr, "Query word %d is %zu bytes long, the query daemon accepts words of at most %d bytes\n",
+                    q + 1, queries->lengths[q], UINT16_MAX);
+            return 0;
+        }
+    }
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        perror("There's an error connecting to the query daemon");
+        if (fd >= 0) {
+            close(fd);
+        }
         return 0;
     }
-    *strings_arr = NULL;
-    *num_strings = 0;
-    char buffer[MAX_STRING_LEN];  // temporary buffer to read strings
 
-    double start_time, end_time;
+    int num_filters = 0;
+    char **labels = NULL;
+    unsigned char *buffer = NULL;
+    size_t capacity = 0;
+    int ok = daemon_client_info(fd, &buffer, &capacity, &labels, &num_filters);
+    unsigned char *results = (unsigned char *)calloc((size_t)num_filters * queries->count + 1, 1);
+    if (ok && results == NULL) {
+        perror("Memory allocation has failed");
+        ok = 0;
+    }
 
-    start_time = omp_get_wtime();
+    int num_requests = 0;
+    double total_latency = 0.0, max_latency = 0.0;
+    double start_time = omp_get_wtime();
+    for (int f = 0; ok && f < num_filters; f++) {
+        for (int first = 0; ok && first < queries->count; first += DAEMON_CLIENT_BATCH) {
+            int count = queries->count - first < DAEMON_CLIENT_BATCH ? queries->count - first : DAEMON_CLIENT_BATCH;
+            double request_start_time = omp_get_wtime();
+            ok = daemon_client_query(fd, &buffer, &capacity, f, queries, first, count,
+                                     results + (size_t)f * queries->count + first);
+            double latency = omp_get_wtime() - request_start_time;
+            total_latency += latency;
+            max_latency = latency > max_latency ? latency : max_latency;
+            num_requests++;
+        }
+    }
+    double query_time = omp_get_wtime() - start_time;
 
-    while (fscanf(file, "%s", buffer) != EOF) {
-        (*total_strings)++;
-        if (!duplicated_strings(buffer, *strings_arr, *num_strings)) {
-            // if the string is not a duplicated string, add it to the array of strings.
-            (*num_strings)++;
-            /*
-            strings_arr: dereferenced to access the pointer to the array strings.
-            realloc dynamically resizes the array of strings. It returns a pointer to the
-            newly allocated memory block, and *strings_arr is updated to point to this
-            new memory block.
-            */
-            *strings_arr = (char **)realloc(*strings_arr, (*num_strings) * sizeof(char *));
-            if (*strings_arr == NULL) {
-                perror("Memory allocation has failed");
-                fclose(file);
-                return 0;
-            }
-            /*
-            *strings_arr is used to access the array of strings, whereas (*num_strings) - 1
-            is used to index the last element in the array of strings. 'strdup' is used to 
-            duplicate the contents of buffer and allocate memory for the new string. The 
-            pointer to this newly allocated memory is stored in the array of strings.
-            */
-            (*strings_arr)[(*num_strings) - 1] = strdup(buffer);
-            if ((*strings_arr)[(*num_strings) - 1] == NULL) {
-                perror("Memory allocation has failed");
-                fclose(file);
-                return 0;
+    if (ok) {
+        print_query_table((const char *const *)labels, num_filters, queries, results);
+        double lookups = (double)num_filters * queries->count;
+        double mean_latency = num_requests > 0 ? total_latency / num_requests : 0.0;
+        printf("Daemon queries: %.0f lookups in %d requests, %lf seconds (%f million queries/s)\n",
+               lookups, num_requests, query_time, per_second(lookups, query_time) / 1e6);
+        printf("Request round trip (microseconds): mean %f, max %f\n\n", mean_latency * 1e6, max_latency * 1e6);
+        if (print_metrics) {
+            printf("metric daemon_queries_per_s %f\n", per_second(lookups, query_time));
+            printf("metric daemon_request_latency_us %f\n", mean_latency * 1e6);
+        }
+    }
+    if (labels != NULL) {
+        free_labels(labels, num_filters);
+    }
+    free(results);
+    free(buffer);
+    close(fd);
+    return ok;
+}
+
+/*
+Function Description: the update mode. Removes the words of 'removals' from, and then inserts
+the words of 'additions' into, the filter loaded from 'path', and writes it back to 'path'
+so a long-lived filter follows a changing vocabulary without being rebuilt from the corpus.
+Either list may be NULL. Words can only be removed from a counting filter, and only words
+that were inserted should be (see bloom_remove). The filter's mapping is private, so making
+it writable copies the pages that change instead of writing into the file that is being
+replaced. 'n' is updated by the number of words added and removed; an added word that was
+already in the filter is counted again. Returns 1 on success, 0 on failure.
+*/
+int update_filter(const char *path, struct bloom_filter *filter, uint64_t *n,
+                  const struct query_set *additions, const struct query_set *removals) {
+    const char *name = filter_kind_names[filter->kind];
+    if (removals != NULL && filter->kind != FILTER_COUNTING) {
+        fprintf(stderr, "%s: words can only be removed from a counting filter\n", path);
+        return 0;
+    }
+    if (mprotect(filter->mapping, filter->mapping_size, PROT_READ | PROT_WRITE) != 0) {
+        perror("There's an error updating the filter file");
+        return 0;
+    }
+
+    double start_time = omp_get_wtime();
+    int removed = 0;
+    int added = 0;
+    if (removals != NULL) {
+        #pragma omp parallel for reduction(+:removed)
+        for (int i = 0; i < removals->count; i++) {
+            removed += bloom_remove(filter, removals->hashes[i]);
+        }
+    }
+    if (additions != NULL) {
+        #pragma omp parallel for
+        for (int i = 0; i < additions->count; i++) {
+            bloom_insert(filter, additions->hashes[i]);
+        }
+        added = additions->count;
+    }
+    *n = *n + added > (uint64_t)removed ? *n + added - removed : 0;
+
+    printf("[%s] %s: added %d words, removed %d", name, path, added, removed);
+    if (removals != NULL) {
+        printf(" (%d were not in the filter), saturated counters: %llu", removals->count - removed,
+               (unsigned long long)counting_saturated_counters(filter));
+    }
+    printf(", %lf seconds\n", omp_get_wtime() - start_time);
+    return save_filter(filter, (int)*n, path);
+}
+
+/*
+Function Description: the query-only mode. Maps the 'num_loaded' filter files named in
+'load_paths' (see load_filter), applies 'additions' and 'removals' to them if either is given
+(see update_filter), and answers the query words in 'queries', if any, from them without
+reading or deduplicating any corpus. If 'socket_path' is not NULL the filters are then
+served on that socket until the daemon is stopped (see run_daemon). Returns the process exit
+status.
+*/
+int run_loaded_filters(const char *const *load_paths, int num_loaded, int verify, struct query_set *queries,
+                       const struct query_set *additions, const struct query_set *removals, const char *socket_path) {
+    double start_time = omp_get_wtime();
+    struct bloom_filter *filters = (struct bloom_filter *)calloc(num_loaded, sizeof(struct bloom_filter));
+    if (filters == NULL) {
+        perror("Memory allocation has failed");
+        return 1;
+    }
+    int status = 0;
+    for (int f = 0; f < num_loaded; f++) {
+        uint64_t n;
+        if (!load_filter(load_paths[f], verify, &filters[f], &n)) {
+            status = 1;
+            continue;
+        }
+        printf("Loaded %s: %s filter, m = %llu bits, k = %d, %zu bytes, built from %llu unique words\n",
+               load_paths[f], filter_kind_names[filters[f].kind], (unsigned long long)filters[f].m, filters[f].k,
+               bloom_filter_bytes(&filters[f]), (unsigned long long)n);
+        if ((additions != NULL || removals != NULL) && !update_filter(load_paths[f], &filters[f], &n, additions, removals)) {
+            status = 1;
+        }
+    }
+    printf("Time to load the filters (seconds): %lf\n\n", omp_get_wtime() - start_time);
+
+    if (queries != NULL && status == 0) {
+        double total_queries = 0.0;
+        double total_query_time = 0.0;
+        if (!run_batch_queries(filters, load_paths, num_loaded, queries, &total_queries, &total_query_time)) {
+            status = 1;
+        } else {
+            printf("Batch queries: %.0f lookups in %lf seconds (%f million queries/s)\n\n",
+                   total_queries, total_query_time, per_second(total_queries, total_query_time) / 1e6);
+        }
+    }
+    if (socket_path != NULL && status == 0 && !run_daemon(filters, load_paths, num_loaded, socket_path)) {
+        status = 1;
+    }
+    for (int f = 0; f < num_loaded; f++) {
+        bloom_filter_free(&filters[f]);
+    }
+    free(filters);
+    return status;
+}
+
+/*
+Struct Description: the list of input files of a run, with the size of each. It is filled
+from the command line (files and directories) and from manifests (-M), and owns its paths.
+*/
+struct input_files {
+    char **paths;
+    size_t *sizes;
+    int count;
+    int capacity;
+};
+
+void input_files_free(struct input_files *inputs) {
+    for (int i = 0; i < inputs->count; i++) {
+        free(inputs->paths[i]);
+    }
+    free(inputs->paths);
+    free(inputs->sizes);
+    memset(inputs, 0, sizeof(*inputs));
+}
+
+int add_input_file(struct input_files *inputs, const char *path, size_t size) {
+    if (inputs->count == inputs->capacity) {
+        int capacity = inputs->capacity ? inputs->capacity * 2 : 64;
+        char **paths = (char **)realloc(inputs->paths, capacity * sizeof(char *));
+        if (paths != NULL) {
+            inputs->paths = paths;
+        }
+        size_t *sizes = (size_t *)realloc(inputs->sizes, capacity * sizeof(size_t));
+        if (sizes != NULL) {
+            inputs->sizes = sizes;
+        }
+        if (paths == NULL || sizes == NULL) {
+            return 0;
+        }
+        inputs->capacity = capacity;
+    }
+    inputs->paths[inputs->count] = strdup(path);
+    if (inputs->paths[inputs->count] == NULL) {
+        return 0;
+    }
+    inputs->sizes[inputs->count++] = size;
+    return 1;
+}
+
+int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+Function Description: adds 'path' to 'inputs'. A directory is walked recursively and every
+regular file in it is added, in name order so that runs are reproducible; hidden entries
+(names starting with '.') are skipped. A path that cannot be examined is still added, with
+size 0, so that the per-file loop reports the error for it like it does for any unreadable
+file. Returns 1 on success, 0 if memory allocation has failed.
+*/
+int add_input_path(struct input_files *inputs, const char *path) {
+    struct stat info;
+    int exists = stat(path, &info) == 0;
+    if (!exists || !S_ISDIR(info.st_mode)) {
+        return add_input_file(inputs, path, exists ? (size_t)info.st_size : 0);
+    }
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        perror("There's an error opening this directory");
+        return 1;
+    }
+    char **names = NULL;
+    int num_names = 0, capacity = 0, ok = 1;
+    struct dirent *entry;
+    while (ok && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        if (num_names == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            char **grown = (char **)realloc(names, capacity * sizeof(char *));
+            if (grown == NULL) {
+                ok = 0;
+                break;
             }
+            names = grown;
+        }
+        size_t len = strlen(path) + strlen(entry->d_name) + 2;
+        names[num_names] = (char *)malloc(len);
+        if (names[num_names] == NULL) {
+            ok = 0;
+            break;
+        }
+        snprintf(names[num_names++], len, "%s/%s", path, entry->d_name);
+    }
+    closedir(dir);
+    if (num_names > 0) {
+        qsort(names, num_names, sizeof(char *), compare_strings);
+    }
+    for (int i = 0; i < num_names; i++) {
+        struct stat child;
+        if (ok && stat(names[i], &child) == 0 && (S_ISDIR(child.st_mode) || S_ISREG(child.st_mode))) {
+            ok = S_ISDIR(child.st_mode) ? add_input_path(inputs, names[i]) : add_input_file(inputs, names[i], child.st_size);
+        }
+        free(names[i]);
+    }
+    free(names);
+    return ok;
+}
+
+/*
+Function Description: adds every path listed in the manifest file 'manifest' ("-" for
+stdin), one per line, to 'inputs' (see add_input_path). Blank lines and lines starting with
+'#' are skipped. Returns 1 on success, 0 if the manifest cannot be read or memory allocation
+has failed.
+*/
+int add_manifest(struct input_files *inputs, const char *manifest) {
+    FILE *file = strcmp(manifest, "-") == 0 ? stdin : fopen(manifest, "r");
+    if (file == NULL) {
+        perror("There's an error opening the manifest");
+        return 0;
+    }
+    char line[4096];
+    int ok = 1;
+    while (ok && fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '\0' && line[0] != '#') {
+            ok = add_input_path(inputs, line);
+        }
+    }
+    if (file != stdin) {
+        fclose(file);
+    }
+    return ok;
+}
+
+struct sized_file {
+    size_t size;
+    int index;
+};
+
+int compare_by_size(const void *a, const void *b) {
+    const struct sized_file *file_a = (const struct sized_file *)a, *file_b = (const struct sized_file *)b;
+    if (file_a->size != file_b->size) {
+        return file_a->size < file_b->size ? 1 : -1;
+    }
+    return file_a->index - file_b->index;
+}
+
+/*
+Function Description: plans the per-file loop as a list of tasks, largest files first. The
+file indices are sorted by size, largest first, into 'order', and consecutive files of that
+order are grouped into tasks: a file of TASK_BATCH_BYTES or more is a task of its own, and
+smaller files are batched together until a batch reaches TASK_BATCH_BYTES, so a corpus of
+thousands of small files costs a few hundred tasks instead of thousands. Task t covers
+order[task_start[t]] to order[task_start[t + 1] - 1]. Returns the number of tasks, or -1 if
+memory allocation has failed.
+*/
+int plan_file_tasks(const size_t *sizes, int num_files, int **order, int **task_start) {
+    struct sized_file *files = (struct sized_file *)malloc((num_files + 1) * sizeof(struct sized_file));
+    *order = (int *)malloc((num_files + 1) * sizeof(int));
+    *task_start = (int *)malloc((num_files + 1) * sizeof(int));
+    if (files == NULL || *order == NULL || *task_start == NULL) {
+        free(files);
+        return -1;
+    }
+    for (int i = 0; i < num_files; i++) {
+        files[i].size = sizes[i];
+        files[i].index = i;
+    }
+    qsort(files, num_files, sizeof(struct sized_file), compare_by_size);
+
+    int num_tasks = 0;
+    size_t batch_bytes = TASK_BATCH_BYTES;
+    for (int w = 0; w < num_files; w++) {
+        if (batch_bytes >= TASK_BATCH_BYTES) {
+            (*task_start)[num_tasks++] = w;
+            batch_bytes = 0;
         }
+        (*order)[w] = files[w].index;
+        batch_bytes += files[w].size;
     }
-    fclose(file);
+    (*task_start)[num_tasks] = num_files;
+    free(files);
+    return num_tasks;
+}
 
-    end_time = omp_get_wtime();
-    *local_read_time = end_time - start_time; // Store the local read time
+/*
+Function Description: prints the command line options of the program to stderr.
+*/
+void print_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-s | -g | -p r,h,i] [-u | -G] [-E] [-f kind[,kind...]] [-x 8|16] [-q queries] [-o dir] [-S socket] [-m] [-j report [-H]] [-M manifest] [file | dir ...]\n", program);
+    fprintf(stderr, "       %s -l filter_file [-l filter_file ...] [-V] [-a words] [-d words] [-q queries] [-S socket] [-j report [-H]]\n", program);
+    fprintf(stderr, "       %s -C socket -q queries [-m]\n", program);
+    fprintf(stderr, "  -s  split mode: process files one at a time, each split across all threads\n");
+    fprintf(stderr, "  -g  streaming mode: insert tokens in a single pass into growing (scalable) filters\n");
+    fprintf(stderr, "  -p  pipelined ingest with r reader, h hasher and i inserter threads, e.g. -p 1,2,1\n");
+    fprintf(stderr, "  -u  corpus mode: size all filters alike and merge them into union and intersection filters\n");
+    fprintf(stderr, "  -G  global mode: all threads insert the words of every file into one shared, sharded filter per kind\n");
+    fprintf(stderr, "  -E  size the filters from a HyperLogLog estimate of the unique words and insert without deduplicating\n");
+    fprintf(stderr, "  -f  filter layouts to build and compare: classic (default), blocked, counting\n");
+    fprintf(stderr, "  -x  also build a static binary fuse filter with 8- or 16-bit fingerprints for every file\n");
+    fprintf(stderr, "  -q  look up every word of the query file ('-' for stdin) in every filter\n");
+    fprintf(stderr, "  -o  write every filter to dir/<file name>.<kind>.bloom after it is built\n");
+    fprintf(stderr, "  -l  query-only mode: map a filter file written by -o instead of reading a corpus\n");
+    fprintf(stderr, "  -V  verify the data checksum of every loaded filter file (reads the whole file);\n");
+    fprintf(stderr, "      with -E, also count the exact unique words to check the estimates against\n");
+    fprintf(stderr, "  -a  insert every word of this file into the loaded filters and save them\n");
+    fprintf(stderr, "  -d  remove every word of this file from the loaded (counting) filters and save them\n");
+    fprintf(stderr, "  -m  also print machine-readable 'metric <name> <value>' lines at the end of the run\n");
+    fprintf(stderr, "  -j  write per-thread phase times, counters and load imbalance as JSON to this file ('-' for stdout)\n");
+    fprintf(stderr, "  -H  with -j, also read the instructions and cache-misses hardware counters of every thread\n");
+    fprintf(stderr, "  -S  daemon mode: serve the built or loaded filters on this Unix socket until SIGINT or SIGTERM\n");
+    fprintf(stderr, "  -C  client mode: look up the words of -q in every filter of the daemon listening on this socket\n");
+    fprintf(stderr, "  -M  also read the files listed in this manifest ('-' for stdin), one path per line\n");
+}
 
+/*
+Function Description: parses the comma separated list of filter kind names in 'list' and
+marks each named kind in 'selected'. Returns 1 if every name is known, 0 otherwise.
+*/
+int parse_filter_kinds(const char *list, int selected[NUM_FILTER_KINDS]) {
+    memset(selected, 0, NUM_FILTER_KINDS * sizeof(int));
+    while (*list != '\0') {
+        size_t len = strcspn(list, ",");
+        int found = 0;
+        for (int kind = 0; kind < NUM_FILTER_KINDS; kind++) {
+            if (strlen(filter_kind_names[kind]) == len && strncmp(list, filter_kind_names[kind], len) == 0) {
+                selected[kind] = 1;
+                found = 1;
+            }
+        }
+        if (!found) {
+            return 0;
+        }
+        list += len;
+        if (*list == ',') {
+            list++;
+        }
+    }
     return 1;
 }
 
+/*
+Function Description: returns the labels of the 'num_kept' filters of 'kept_filters' (see
+main), "<file name>[<kind>]" or "union[<kind>]" / "intersection[<kind>]" for the merged ones,
+with a NULL label for every filter that was not built. Returns NULL if memory allocation has
+failed; free the labels with free_labels.
+*/
+char **kept_filter_labels(const struct bloom_filter *kept_filters, int num_kept, const char **filenames, int num_files) {
+    char **labels = (char **)calloc(num_kept, sizeof(char *));
+    if (labels == NULL) {
+        return NULL;
+    }
+    for (int f = 0; f < num_kept; f++) {
+        if (kept_filters[f].words == NULL) {
+            continue;
+        }
+        int row = f / NUM_FILTER_KINDS;
+        const char *source = row < num_files ? filenames[row] : row == num_files ? "union" : "intersection";
+        size_t label_len = strlen(source) + 16;
+        labels[f] = (char *)malloc(label_len);
+        if (labels[f] == NULL) {
+            free_labels(labels, num_kept);
+            return NULL;
+        }
+        snprintf(labels[f], label_len, "%s[%s]", source, filter_kind_names[f % NUM_FILTER_KINDS]);
+    }
+    return labels;
+}
+
 /*
 Approach Description: The main function initially is executed by a single thread. Whereas inside
 the main function, where the it loops over the num_files, the OpenMP parallelization kicks off. 
@@ -135,14 +4954,296 @@ are completed, the reduction clauses ensure that each thread's contribution to t
 and the 'total_optimization_time are correctly combined into their global values. This parallization
 approach allowed me to process the multiple text files concurrenty. 
 
+With '-s' (split mode) the files are processed one after another instead, and all threads
+work on the same file: read_strings_from_file_split cuts it into one byte range per thread,
+and the insertion loop spreads the unique words over all threads as well. The outer loop's
+if() clause turns its parallel region off in this mode, so the nested regions get the whole
+team. Files and directories named on the command line, and the files listed in manifests
+(-M), replace the default list.
+
+The files are handed out as OpenMP tasks rather than as a statically scheduled loop: a
+thread that finishes a task takes the next one. OpenMP leaves the order in which tasks run
+to the runtime (libgomp, for one, has the creating thread start with the task it created
+last), so a task is not bound to a file when it is created; it claims the next entry of
+the plan of plan_file_tasks when it starts. The biggest books therefore start first and
+small files fill the gaps at the end instead of one thread being left with a big file
+while the others are idle.
 */
-int main() {
-    const char *filenames[] = {"MOBY_DICK.txt", "LITTLE_WOMEN.txt", "SHAKESPEARE.txt"};
-    int num_files = sizeof(filenames) / sizeof(filenames[0]);
+int main(int argc, char *argv[]) {
+    const char *default_filenames[] = {"MOBY_DICK.txt", "LITTLE_WOMEN.txt"};
+    const char **filenames = default_filenames;
+    int num_files = sizeof(default_filenames) / sizeof(default_filenames[0]);
+    int split_mode = 0;
+    int streaming_mode = 0;
+    int pipeline_mode = 0;
+    int corpus_mode = 0;
+    int global_mode = 0;
+    int estimate_mode = 0;
+    int stage_threads[3] = {1, 1, 1};
+    int selected_kinds[NUM_FILTER_KINDS] = {1, 0};
+    const char *query_filename = NULL;
+    const char *save_dir = NULL;
+    const char **load_paths = (const char **)calloc(argc, sizeof(const char *));
+    const char **manifests = (const char **)calloc(argc, sizeof(const char *));
+    int num_manifests = 0;
+    int num_loaded = 0;
+    int verify = 0;
+    int print_metrics = 0;
+    const char *add_filename = NULL;
+    const char *remove_filename = NULL;
+    const char *report_filename = NULL;
+    int hardware_counters = 0;
+    const char *socket_path = NULL;
+    const char *client_socket_path = NULL;
+    int fuse_bits = 0;
+    if (load_paths == NULL || manifests == NULL) {
+        perror("Memory allocation has failed");
+        return 1;
+    }
+
+    int option;
+    while ((option = getopt(argc, argv, "sguGEp:f:x:q:o:l:Vma:d:j:HS:C:M:")) != -1) {
+        switch (option) {
+            case 's':
+                split_mode = 1;
+                break;
+            case 'g':
+                streaming_mode = 1;
+                break;
+            case 'u':
+                corpus_mode = 1;
+                break;
+            case 'G':
+                global_mode = 1;
+                break;
+            case 'E':
+                estimate_mode = 1;
+                break;
+            case 'p':
+                if (sscanf(optarg, "%d,%d,%d", &stage_threads[0], &stage_threads[1], &stage_threads[2]) != 3 ||
+                    stage_threads[0] < 1 || stage_threads[1] < 1 || stage_threads[2] < 1) {
+                    fprintf(stderr, "-p needs three thread counts, readers,hashers,inserters\n");
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                pipeline_mode = 1;
+                break;
+            case 'f':
+                if (!parse_filter_kinds(optarg, selected_kinds)) {
+                    fprintf(stderr, "Unknown filter kind in '%s'\n", optarg);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'x':
+                fuse_bits = atoi(optarg);
+                if (fuse_bits != 8 && fuse_bits != 16) {
+                    fprintf(stderr, "-x needs the fingerprint size of the binary fuse filter, 8 or 16 bits\n");
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'q':
+                query_filename = optarg;
+                break;
+            case 'o':
+                save_dir = optarg;
+                break;
+            case 'l':
+                load_paths[num_loaded++] = optarg;
+                break;
+            case 'V':
+                verify = 1;
+                break;
+            case 'm':
+                print_metrics = 1;
+                break;
+            case 'a':
+                add_filename = optarg;
+                break;
+            case 'd':
+                remove_filename = optarg;
+                break;
+            case 'j':
+                report_filename = optarg;
+                break;
+            case 'H':
+                hardware_counters = 1;
+                break;
+            case 'S':
+                socket_path = optarg;
+                break;
+            case 'C':
+                client_socket_path = optarg;
+                break;
+            case 'M':
+                manifests[num_manifests++] = optarg;
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    struct input_files inputs;
+    memset(&inputs, 0, sizeof(inputs));
+    int inputs_ok = 1;
+    for (int a = optind; a < argc; a++) {
+        inputs_ok = inputs_ok && add_input_path(&inputs, argv[a]);
+    }
+    for (int m = 0; m < num_manifests; m++) {
+        inputs_ok = inputs_ok && add_manifest(&inputs, manifests[m]);
+    }
+    if (optind == argc && num_manifests == 0) {
+        for (int f = 0; f < num_files; f++) {
+            inputs_ok = inputs_ok && add_input_path(&inputs, default_filenames[f]);
+        }
+    }
+    if (!inputs_ok) {
+        fprintf(stderr, "The list of input files could not be read\n");
+        return 1;
+    }
+    filenames = (const char **)inputs.paths;
+    num_files = inputs.count;
+    if (num_files == 0 && num_loaded == 0 && client_socket_path == NULL) {
+        fprintf(stderr, "No input files\n");
+        return 1;
+    }
+
+    /*
+    in query, corpus and daemon mode the filters outlive the per-file loop: kept_filters[i * NUM_FILTER_KINDS
+    + kind] holds the filter of kind 'kind' built for file i, or a NULL 'words' if it was not built.
+    */
+    struct query_set queries;
+    struct bloom_filter *kept_filters = NULL;
+    if (query_filename != NULL && !load_query_set(query_filename, &queries)) {
+        return 1;
+    }
+    if (streaming_mode && (split_mode || query_filename != NULL || save_dir != NULL || num_loaded > 0)) {
+        fprintf(stderr, "-g streams each file into its own growing filters, it cannot be combined with -s, -q, -o or -l\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (pipeline_mode && (split_mode || streaming_mode || num_loaded > 0)) {
+        fprintf(stderr, "-p replaces the per-file loop, it cannot be combined with -s, -g or -l\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (corpus_mode && (streaming_mode || pipeline_mode || num_loaded > 0)) {
+        fprintf(stderr, "-u merges filters built from deduplicated files, it cannot be combined with -g, -p or -l\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (global_mode && (corpus_mode || streaming_mode || pipeline_mode || query_filename != NULL || save_dir != NULL ||
+                        socket_path != NULL || fuse_bits != 0 || num_loaded > 0)) {
+        fprintf(stderr, "-G builds one filter for all files, it cannot be combined with -u, -g, -p, -q, -o, -S, -x or -l\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (estimate_mode && (corpus_mode || streaming_mode || pipeline_mode || query_filename != NULL || save_dir != NULL ||
+                          socket_path != NULL || fuse_bits != 0 || num_loaded > 0)) {
+        fprintf(stderr, "-E inserts without keeping the words, it cannot be combined with -u, -g, -p, -q, -o, -S, -x or -l\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (hardware_counters && report_filename == NULL) {
+        fprintf(stderr, "-H adds hardware counters to the -j report, so it needs -j\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    double run_start_time = omp_get_wtime();
+    if (report_filename != NULL && !instrumentation_init(hardware_counters)) {
+        perror("Memory allocation has failed");
+        return 1;
+    }
+    if (client_socket_path != NULL) {
+        if (query_filename == NULL || socket_path != NULL || num_loaded > 0) {
+            fprintf(stderr, "-C sends the words of -q to a running daemon, it needs -q and cannot be combined with -S or -l\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        int ok = run_daemon_client(client_socket_path, &queries, print_metrics);
+        free_query_set(&queries);
+        free(load_paths);
+        free(manifests);
+        input_files_free(&inputs);
+        return ok ? 0 : 1;
+    }
+    if (fuse_bits != 0 && (streaming_mode || num_loaded > 0)) {
+        fprintf(stderr, "-x builds a static filter from each file's unique words, it cannot be combined with -g or -l\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (socket_path != NULL && streaming_mode) {
+        fprintf(stderr, "-g does not keep its filters, it cannot be combined with -S\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if ((add_filename != NULL || remove_filename != NULL) && num_loaded == 0) {
+        fprintf(stderr, "-a and -d update filter files, so they need -l\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (num_loaded > 0) {
+        struct query_set additions, removals;
+        memset(&additions, 0, sizeof(additions));
+        memset(&removals, 0, sizeof(removals));
+        int status = 1;
+        if ((add_filename == NULL || load_query_set(add_filename, &additions)) &&
+            (remove_filename == NULL || load_query_set(remove_filename, &removals))) {
+            if (add_filename != NULL) {
+                hash_query_set(&additions);
+            }
+            if (remove_filename != NULL) {
+                hash_query_set(&removals);
+            }
+            status = run_loaded_filters(load_paths, num_loaded, verify, query_filename != NULL ? &queries : NULL,
+                                        add_filename != NULL ? &additions : NULL, remove_filename != NULL ? &removals : NULL,
+                                        socket_path);
+        }
+        free_query_set(&additions);
+        free_query_set(&removals);
+        if (query_filename != NULL) {
+            free_query_set(&queries);
+        }
+        free(load_paths);
+        free(manifests);
+        input_files_free(&inputs);
+        if (report_filename != NULL && !write_instrumentation_report(report_filename, omp_get_wtime() - run_start_time)) {
+            return 1;
+        }
+        return status;
+    }
+    /*
+    in corpus mode the per-file filters are kept for merging, followed by two more rows of
+    NUM_FILTER_KINDS for the union and the intersection filters.
+    */
+    int num_kept = (num_files + 2 * corpus_mode) * NUM_FILTER_KINDS;
+    struct string_set *corpus_sets = NULL;
+    char *have_set = NULL;
+    if (query_filename != NULL || corpus_mode || global_mode || socket_path != NULL) {
+        kept_filters = (struct bloom_filter *)calloc(num_kept, sizeof(struct bloom_filter));
+        corpus_sets = (struct string_set *)calloc(num_files, sizeof(struct string_set));
+        have_set = (char *)calloc(num_files, 1);
+        if (kept_filters == NULL || corpus_sets == NULL || have_set == NULL) {
+            perror("Memory allocation has failed");
+            return 1;
+        }
+    }
     
     double total_optimization_time = 0.0;
+    double total_read_time = 0.0;
+    size_t total_bytes_read = 0;
+    double total_tokens = 0.0;
     int total_unique_words = 0;
-    int m = 0; // Added variable declaration for m
+    struct filter_result kind_totals[NUM_FILTER_KINDS];
+    struct filter_result fuse_totals;
+    memset(kind_totals, 0, sizeof(kind_totals));
+    memset(&fuse_totals, 0, sizeof(fuse_totals));
+    // in estimating mode the per-file sketches are merged here, 16 KiB however many files there are
+    struct estimate_totals estimates;
+    memset(&estimates, 0, sizeof(estimates));
+    string_set_init(&estimates.words);
+    estimates.validate = estimate_mode && verify;
 
     double total_start_time, total_end_time; // Added double variables
     
@@ -151,109 +5252,292 @@ int main() {
 
     total_start_time = omp_get_wtime(); // Measure the start time before entering the loop
 
-    // Parallelize the file reading and processing loop
-    /*
-    total_unique_words and total_optimization_time should be treated as private within each thread
-    and the combined (reduced) into their global values after the loop is done. This allows threads
-    to update these variables independently without causing race conditions.
-    */
-    #pragma omp parallel for reduction(+:total_unique_words) reduction(+:total_optimization_time)
-    for (int i = 0; i < num_files; i++) {
-        char **strings_arr = NULL;
-        int num_strings = 0;
-        int total_strings = 0;
-        double false_positive_rate = 0.0;
-
-        // Flag to indicate if an error occurred in this file
-        int error = 0;
-
-        double local_read_time = 0.0;
-        double local_optimization_time = 0.0;
-        //passing address by reference from the read_strings_from_file function
-        if (read_strings_from_file(filenames[i], &strings_arr, &num_strings, &total_strings, &local_read_time)) {
-            total_unique_words += num_strings;
-
-            printf("Initial bit array size based on the number of unique words in %s: %d\n", filenames[i], num_strings);
-            int n = num_strings;
-
-            double start_optimization_time = omp_get_wtime(); // Start measuring optimization time
-            m = calc_optimum_bitArraySize(n, MAX_FP_RATE);
-            false_positive_rate = pow(1 - pow(1 - (1.0 / m), NUM_HASH_FUNCTIONS * n), NUM_HASH_FUNCTIONS);
-            printf("False Positive Rate: %f\n", false_positive_rate);
-	    
-	    	/*
-	    	*bit_array is used to create a dynamically allocated array of integers.
-	    	'calloc' will then allocate memory for an array of 'm' integers, and *bit_array
-	    	points to the start of this allocated memory block.
-	    	*/
-            int *bit_array = (int *)calloc(m, sizeof(int));
-            if (bit_array == NULL) {
-                perror("Memory allocation has failed");
-                error = 1; // Set error flag
-            }
+    if (pipeline_mode) {
+        struct pipeline_output output;
+        memset(&output, 0, sizeof(output));
+        output.selected = selected_kinds;
+        output.save_dir = save_dir;
+        output.kept_filters = kept_filters;
+        output.kind_totals = kind_totals;
+        output.fuse_bits = fuse_bits;
+        output.fuse_totals = &fuse_totals;
+        if (!run_pipeline(filenames, num_files, stage_threads, &output)) {
+            return 1;
+        }
+        total_unique_words = output.unique_words;
+        total_tokens = output.tokens;
+        total_bytes_read = output.bytes_read;
+        total_read_time = output.read_time;
+        total_optimization_time = output.optimization_time;
+    } else if (estimate_mode && global_mode) {
+        total_optimization_time = build_global_estimated_filters(filenames, num_files, selected_kinds, &estimates, kind_totals,
+                                                                 &total_tokens, &total_bytes_read, &total_read_time);
+        total_unique_words = (int)(estimates.estimated + 0.5);
+    } else {
+        int *order, *task_start;
+        int num_tasks = plan_file_tasks(inputs.sizes, num_files, &order, &task_start);
+        if (num_tasks < 0) {
+            perror("Memory allocation has failed");
+            return 1;
+        }
+        // Parallelize the file reading and processing loop
+        /*
+        total_unique_words, total_optimization_time and the read totals should be treated as private
+        within each task and then combined (reduced) into their global values at the end of the taskgroup. This allows threads
+        to update these variables independently without causing race conditions. One thread creates the
+        tasks and every thread of the team (the single one as well) runs them; whichever task starts
+        next takes the next plan entry, so the files start largest first.
+        */
+        int next_task = 0;
+        #pragma omp parallel if(!split_mode)
+        #pragma omp single
+        #pragma omp taskgroup task_reduction(+:total_unique_words, total_optimization_time) \
+            task_reduction(+:total_read_time, total_bytes_read, total_tokens)
+        for (int n = 0; n < num_tasks; n++) {
+            #pragma omp task in_reduction(+:total_unique_words, total_optimization_time) \
+                in_reduction(+:total_read_time, total_bytes_read, total_tokens)
+            {
+                int t;
+                #pragma omp atomic capture
+                t = next_task++;
+                for (int w = task_start[t]; w < task_start[t + 1]; w++) {
+                    int i = order[w];
+                    struct string_set set;
+                    int total_strings = 0;
 
-            if (!error) {
-                for (int i = 0; i < num_strings; i++) {
-                    for (int j = 0; j < NUM_HASH_FUNCTIONS; j++) {
-                        int hash = division_method_hash(strings_arr[i], m);
-                        bit_array[hash] = 1;
+                    double local_read_time = 0.0;
+                    double local_optimization_time = 0.0;
+
+                    if (streaming_mode) {
+                        struct filter_result results[NUM_FILTER_KINDS];
+                        int unique_words = 0;
+                        if (stream_file_into_filters(filenames[i], selected_kinds, results, &unique_words,
+                                                     &total_strings, &total_bytes_read, &local_read_time)) {
+                            total_unique_words += unique_words;
+                            #pragma omp critical
+                            for (int kind = 0; kind < NUM_FILTER_KINDS; kind++) {
+                                add_filter_result(&kind_totals[kind], &results[kind]);
+                            }
+                            // one streaming pass fills the filters of every kind, so its time is counted once
+                            for (int kind = 0; kind < NUM_FILTER_KINDS; kind++) {
+                                local_optimization_time = fmax(local_optimization_time, results[kind].optimization_time);
+                            }
+                            total_optimization_time += local_optimization_time;
+                        } else {
+                            printf("Error reading strings from the text file %s\n", filenames[i]);
+                        }
+                        printf("\n");
+                        total_read_time += local_read_time;
+                        total_tokens += total_strings;
+                        continue;
                     }
-                }
-                const char *query = "geohash";
-                int is_present = 1;
-                for (int j = 0; j < NUM_HASH_FUNCTIONS; j++) {
-                    int hash = division_method_hash(query, m);
-                    if (bit_array[hash] == 0) {
-                        is_present = 0;
-                        break;
+                    if (estimate_mode) {
+                        struct filter_result results[NUM_FILTER_KINDS];
+                        double estimated_words = 0.0;
+                        if (estimate_file_into_filters(filenames[i], selected_kinds, split_mode, &estimates, results, &estimated_words,
+                                                       &total_strings, &total_bytes_read, &local_read_time)) {
+                            total_unique_words += (int)(estimated_words + 0.5);
+                            #pragma omp critical
+                            for (int kind = 0; kind < NUM_FILTER_KINDS; kind++) {
+                                add_filter_result(&kind_totals[kind], &results[kind]);
+                            }
+                            // one insert pass fills the filters of every kind, so its time is counted once
+                            for (int kind = 0; kind < NUM_FILTER_KINDS; kind++) {
+                                local_optimization_time = fmax(local_optimization_time, results[kind].optimization_time);
+                            }
+                            total_optimization_time += local_optimization_time;
+                        } else {
+                            printf("Error reading strings from the text file %s\n", filenames[i]);
+                        }
+                        printf("\n");
+                        total_read_time += local_read_time;
+                        total_tokens += total_strings;
+                        continue;
                     }
-                }
-                if (is_present) {
-                    printf("The string '%s' is potentially in the bloom filter.\n\n", query);
-                } else {
-                    printf("The string '%s' does not exist in the bloom filter.\n\n", query);
-                }
-            }
-            double end_optimization_time = omp_get_wtime(); // End measuring optimization time
+                    //passing address by reference from the read_strings_from_file function
+                    int read_ok = split_mode ? read_strings_from_file_split(filenames[i], &set, &total_strings, &total_bytes_read, &local_read_time)
+                                             : read_strings_from_file(filenames[i], &set, &total_strings, &total_bytes_read, &local_read_time);
+                    total_read_time += local_read_time;
+                    total_tokens += total_strings;
+                    if (read_ok) {
+                        total_unique_words += set.count;
 
-            // Free memory allocated for this file's strings
-            // strings_arr[i] is used to access individual strings in the array of strings
-            //dereferenced to get the pointer to the specific string to be freed.
-            for (int i = 0; i < num_strings; i++) {
-                free(strings_arr[i]);
-            }
-            free(strings_arr);
-            free(bit_array);
+                        if (corpus_mode || global_mode) {
+                            // the filters are built once every file has been read (see build_corpus_filters and build_global_filters)
+                            corpus_sets[i] = set;
+                            have_set[i] = 1;
+                        } else {
+                            local_optimization_time = build_file_filters(filenames[i], i, &set, selected_kinds, NULL, NULL,
+                                                                         save_dir, kept_filters, kind_totals, fuse_bits, &fuse_totals);
 
-            // Accumulate local optimization time
-            local_optimization_time = end_optimization_time - start_optimization_time;
-        } 
+                            // Free the file's unique words; the set owns all of them in its arena
+                            string_set_free(&set);
+                        }
+                    } 
         
-        else {
-            printf("Error reading strings from the text file %s\n", filenames[i]);
-            error = 1; // Set error flag
-        }
+                    else {
+                        printf("Error reading strings from the text file %s\n", filenames[i]);
+                    }
 
-        // Accumulate local read time
-        /*
-        local_optimization_time is performed atomic-cally without race conditions by multiple
-        threads. Each thread calculates its local optimization time, and this directive 
-        ensures that the values are safely accumulated into the total_optimization_time.  
-        */
-        #pragma omp atomic
-        total_optimization_time += local_optimization_time;
+                    // Accumulate local optimization time
+                    /*
+                    total_optimization_time is already private to each task through the in_reduction
+                    clause, so no atomic is needed here: the private copies are summed at the end of the taskgroup.
+                    */
+                    total_optimization_time += local_optimization_time;
+                }
+            }
+        }
+        free(order);
+        free(task_start);
+    
     }
     
+    if (corpus_mode) {
+        total_optimization_time += build_corpus_filters(filenames, num_files, corpus_sets, have_set, selected_kinds,
+                                                        save_dir, split_mode, kept_filters, kind_totals,
+                                                        fuse_bits, &fuse_totals);
+    }
+    if (global_mode && !estimate_mode) {
+        total_optimization_time += build_global_filters(num_files, corpus_sets, have_set, selected_kinds, kind_totals);
+    }
+    free(corpus_sets);
+    free(have_set);
+    
     total_end_time = omp_get_wtime(); // Measure the end time after the loop completes
 
+    double total_query_time = 0.0;
+    double total_queries = 0.0;
+    char **labels = NULL;
+    if (query_filename != NULL || socket_path != NULL) {
+        labels = kept_filter_labels(kept_filters, num_kept, filenames, num_files);
+        if (labels == NULL) {
+            perror("Memory allocation has failed");
+            return 1;
+        }
+    }
+    if (query_filename != NULL) {
+        if (!run_batch_queries(kept_filters, (const char *const *)labels, num_kept, &queries, &total_queries, &total_query_time)) {
+            return 1;
+        }
+        free_query_set(&queries);
+    }
+
     // Calculate and print total process time
     double total_process_time = total_end_time - total_start_time; 
-    double total_read_time = total_process_time - total_optimization_time;
-    printf("Optimal bit array size based on calculations: %d\n", m);
+    /*
+    every thread sizes its own filters, so the largest m is combined per kind in kind_totals
+    (see add_filter_result) instead of each thread overwriting one shared variable.
+    */
+    uint64_t m = 0;
+    for (int kind = 0; kind < NUM_FILTER_KINDS; kind++) {
+        if (kind_totals[kind].m > m) {
+            m = kind_totals[kind].m;
+        }
+    }
+    printf("Optimal bit array size based on calculations (largest filter): %llu\n", (unsigned long long)m);
     printf("Total unique strings from all files: %d\n", total_unique_words);
+    if (estimate_mode) {
+        double corpus_estimate = hll_estimate(&estimates.sketch);
+        printf("HyperLogLog estimates of unique words: %.0f summed over the files, %.0f across all files\n",
+               estimates.estimated, corpus_estimate);
+        if (estimates.validate) {
+            printf("Exact unique words: %.0f summed over the files (error %+.2f%%), %d across all files (error %+.2f%%)\n",
+                   estimates.exact, estimates.exact > 0 ? 100.0 * (estimates.estimated - estimates.exact) / estimates.exact : 0.0,
+                   estimates.words.count,
+                   estimates.words.count > 0 ? 100.0 * (corpus_estimate - estimates.words.count) / estimates.words.count : 0.0);
+        }
+    }
     printf("Total time for reading and counting unique words (seconds): %lf\n", total_read_time);
+    printf("Ingest throughput (MB per second spent reading): %lf\n", per_second(total_bytes_read / 1e6, total_read_time));
     printf("Total time for optimization and insertion (seconds): %lf\n", total_optimization_time);
+    for (int kind = 0; kind < NUM_FILTER_KINDS; kind++) {
+        const struct filter_result *totals = &kind_totals[kind];
+        if (!selected_kinds[kind]) {
+            continue;
+        }
+        printf("[%s] Total bit array memory (bytes): %zu (one int per bit would use %zu), %f bits per word\n",
+               filter_kind_names[kind], totals->filter_bytes, totals->unpacked_bytes,
+               per_second(8.0 * totals->filter_bytes, totals->unique_words));
+        printf("[%s] Empirical False Positive Rate: %f, throughput (million words/s): insert %f, query %f\n",
+               filter_kind_names[kind], totals->queries > 0 ? totals->false_positives / totals->queries : 0.0,
+               per_second(totals->inserts, totals->insert_time) / 1e6, per_second(totals->queries, totals->query_time) / 1e6);
+    }
+    if (fuse_bits != 0) {
+        printf("[fuse%d] Total fingerprint memory (bytes): %zu, %f bits per word\n",
+               fuse_bits, fuse_totals.filter_bytes, per_second(8.0 * fuse_totals.filter_bytes, fuse_totals.unique_words));
+        printf("[fuse%d] Empirical False Positive Rate: %f, throughput (million words/s): build %f, query %f\n",
+               fuse_bits, fuse_totals.queries > 0 ? fuse_totals.false_positives / fuse_totals.queries : 0.0,
+               per_second(fuse_totals.inserts, fuse_totals.insert_time) / 1e6,
+               per_second(fuse_totals.queries, fuse_totals.query_time) / 1e6);
+    }
+    if (query_filename != NULL) {
+        printf("Batch queries: %.0f lookups in %lf seconds (%f million queries/s)\n",
+               total_queries, total_query_time, per_second(total_queries, total_query_time) / 1e6);
+    }
     printf("Total Process time (seconds): %lf\n\n", total_process_time);
 
-    return 0;
+    /*
+    machine-readable summary for bench/run_bench.sh: one "metric <name> <value>" line per
+    number, with the per-kind numbers prefixed by the kind name.
+    */
+    if (print_metrics) {
+        printf("metric threads %d\n", omp_get_max_threads());
+        printf("metric bytes_read %zu\n", total_bytes_read);
+        printf("metric tokens %.0f\n", total_tokens);
+        printf("metric unique_words %d\n", total_unique_words);
+        if (estimate_mode) {
+            printf("metric hll_unique_words %f\n", hll_estimate(&estimates.sketch));
+            if (estimates.validate) {
+                printf("metric exact_unique_words %d\n", estimates.words.count);
+            }
+        }
+        printf("metric ingest_mb_per_s %f\n", per_second(total_bytes_read / 1e6, total_read_time));
+        printf("metric total_seconds %f\n", total_process_time);
+        for (int kind = 0; kind < NUM_FILTER_KINDS; kind++) {
+            const struct filter_result *totals = &kind_totals[kind];
+            if (!selected_kinds[kind]) {
+                continue;
+            }
+            const char *name = filter_kind_names[kind];
+            printf("metric %s_filter_bytes %zu\n", name, totals->filter_bytes);
+            printf("metric %s_bits_per_key %f\n", name, per_second(8.0 * totals->filter_bytes, totals->unique_words));
+            printf("metric %s_inserts_per_s %f\n", name, per_second(totals->inserts, totals->insert_time));
+            printf("metric %s_queries_per_s %f\n", name, per_second(totals->queries, totals->query_time));
+            printf("metric %s_empirical_fpr %f\n", name, totals->queries > 0 ? totals->false_positives / totals->queries : 0.0);
+        }
+        if (fuse_bits != 0) {
+            printf("metric fuse%d_filter_bytes %zu\n", fuse_bits, fuse_totals.filter_bytes);
+            printf("metric fuse%d_bits_per_key %f\n", fuse_bits, per_second(8.0 * fuse_totals.filter_bytes, fuse_totals.unique_words));
+            printf("metric fuse%d_inserts_per_s %f\n", fuse_bits, per_second(fuse_totals.inserts, fuse_totals.insert_time));
+            printf("metric fuse%d_queries_per_s %f\n", fuse_bits, per_second(fuse_totals.queries, fuse_totals.query_time));
+            printf("metric fuse%d_empirical_fpr %f\n", fuse_bits,
+                   fuse_totals.queries > 0 ? fuse_totals.false_positives / fuse_totals.queries : 0.0);
+        }
+        if (query_filename != NULL) {
+            printf("metric batch_queries_per_s %f\n", per_second(total_queries, total_query_time));
+        }
+    }
+
+    // the daemon serves the filters once the run's summary is out
+    int status = 0;
+    if (socket_path != NULL && !run_daemon(kept_filters, (const char *const *)labels, num_kept, socket_path)) {
+        status = 1;
+    }
+    if (labels != NULL) {
+        free_labels(labels, num_kept);
+    }
+    for (int f = 0; kept_filters != NULL && f < num_kept; f++) {
+        bloom_filter_free(&kept_filters[f]);
+    }
+    free(kept_filters);
+
+    string_set_free(&estimates.words);
+    free(load_paths);
+    free(manifests);
+    input_files_free(&inputs);
+    if (report_filename != NULL && !write_instrumentation_report(report_filename, omp_get_wtime() - run_start_time)) {
+        return 1;
+    }
+    return status;
 }
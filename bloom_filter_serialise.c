@@ -3,133 +3,463 @@
 #include <stdio.h>
 #include <time.h>
 #include <math.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <ctype.h>
 
 
 #define MAX_STRING_LEN 100
 #define MAX_FP_RATE 0.05
-#define NUM_HASH_FUNCTIONS 4
+#define MAX_HASH_FUNCTIONS 16
+#define HASH_SEED 0x9e3779b97f4a7c15ULL
+#define FP_TEST_WORDS 100000
 
 /*
-Function Description: calculates the optimum bit array 'm' based on the number
-of unique words 'n' and the desired false positive rate 'max_fp_rate'. It will
-iteratively calculate the false positive rate unit it falls below the desired
-maximum fp '0.05'.
+Function Description: calculates the optimum bit array size 'm' for 'n' unique words and the
+desired false positive rate 'max_fp_rate' in closed form, m = -n ln(p) / (ln 2)^2, rounded up
+to a power of two (and at least one 64-bit word) so that a probe index can be reduced with a
+mask instead of a modulo. Rounding up only lowers the false positive rate, because
+calc_optimum_hash_functions then picks k for the larger m.
 */
-int calc_optimum_bitArraySize(int n, double max_fp_rate) {
-    int k = NUM_HASH_FUNCTIONS;
-    double m = 1.0;
-    double current_false_positive_rate = 1.0;
+uint64_t calc_optimum_bitArraySize(int n, double max_fp_rate) {
+    double optimum = -n * log(max_fp_rate) / (log(2) * log(2));
+    uint64_t m = 64;
+    while ((double)m < optimum) {
+        m <<= 1;
+    }
+    return m;
+}
 
-    while (current_false_positive_rate > max_fp_rate) {
-        m++;
-        current_false_positive_rate = pow(1 - pow(1 - (1.0 / m), k * n), k);
+/*
+Function Description: the number of hash functions that minimises the false positive rate of
+a filter of 'm' bits holding 'n' words, k = (m / n) ln 2, rounded and kept within
+1..MAX_HASH_FUNCTIONS.
+*/
+int calc_optimum_hash_functions(int n, uint64_t m) {
+    if (n == 0) {
+        return 1;
+    }
+    long k = lround((double)m / n * log(2));
+    if (k < 1) {
+        return 1;
     }
-    return (int)(-n * log(max_fp_rate) / ((log(2) * log(2))));
+    return k > MAX_HASH_FUNCTIONS ? MAX_HASH_FUNCTIONS : (int)k;
 }
 
 /*
-Function Description: The division method hash is used to hash each  unique word 
-before inserting the value into the bloom filter. It will initialize a 'hash'
-variable to zero and iterates through the chracacters in the word. Through this
-process, each ASCII Values of the characters in the word are summed up, then it
-will me modulo-ed to fit the result within the range of the bit array size.
+Function Description: 64-bit MurmurHash64A of the 'len' bytes at 'word'. Every word is
+hashed exactly once with this function, when it is read into the string set; the stored
+hash then drives both the set's slot table and the k bloom filter probes. Unlike summing
+the ASCII values, every byte and its position affect all 64 output bits, so anagrams do not
+collide.
 */
-int division_method_hash(const char *word, int m) {
-    unsigned long hash = 0;
-    size_t len = strlen(word);
-    for (int i = 0; i < len; i++) {
-        hash += (unsigned long)word[i];
+uint64_t string_hash(const char *word, size_t len) {
+    const uint64_t mul = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t hash = HASH_SEED ^ (len * mul);
+    const unsigned char *data = (const unsigned char *)word;
+    const unsigned char *end = data + (len & ~(size_t)7);
+
+    while (data != end) {
+        uint64_t block;
+        memcpy(&block, data, sizeof(block));
+        block *= mul;
+        block ^= block >> r;
+        block *= mul;
+        hash ^= block;
+        hash *= mul;
+        data += 8;
+    }
+    switch (len & 7) {
+        case 7: hash ^= (uint64_t)data[6] << 48; // fall through
+        case 6: hash ^= (uint64_t)data[5] << 40; // fall through
+        case 5: hash ^= (uint64_t)data[4] << 32; // fall through
+        case 4: hash ^= (uint64_t)data[3] << 24; // fall through
+        case 3: hash ^= (uint64_t)data[2] << 16; // fall through
+        case 2: hash ^= (uint64_t)data[1] << 8;  // fall through
+        case 1: hash ^= (uint64_t)data[0];
+                hash *= mul;
     }
-    return (int)(hash % m);
+    hash ^= hash >> r;
+    hash *= mul;
+    hash ^= hash >> r;
+    return hash;
 }
 
 /*
-Function Description: checks if a given 'string' exists within an array of strings
-'strings_arr' up to a specific number of strings 'num_strings' that needs to be 
-checked. It comparses the strings each string to check for potential duplications.
-If its a duplicate: 1, if not 0.
+Function Description: derives the j-th of k bit indices from a word's 64-bit hash using
+double hashing, g_j = h1 + j * h2 (mod m). h1 is the hash itself and h2 is a remix of it
+forced to be odd, so the k probes of one word land on k different bits instead of the same
+bit k times. m is a power of two, so the modulo is the mask m - 1.
+*/
+uint64_t bloom_second_hash(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash | 1;
+}
 
-**strings_arr: double pointer representing an array of strings. Each element of strings_arr
-is a pointer to a string.
+uint64_t bloom_probe_index(uint64_t h1, uint64_t h2, int j, uint64_t mask) {
+    return (h1 + (uint64_t)j * h2) & mask;
+}
+
+/*
+Struct Description: a hash set of unique words that owns its strings. The words are copied
+back to back (NUL-terminated) into one 'arena' buffer, and 'entries' holds, for every
+unique word in insertion order, its offset into the arena, its length and its hash.
+'slots' is an open addressing (linear probing) table of entry indices plus one, where zero
+marks an empty slot. All three buffers grow geometrically, so inserting a word costs O(1)
+amortized and freeing the whole set is a handful of free() calls instead of one per word.
 */
-int duplicated_strings(const char *string, char **strings_arr, int num_strings) {
-    for (int i = 0; i < num_strings; i++) {
-        if (strcmp(strings_arr[i], string) == 0) {
-            return 1;
+struct string_entry {
+    uint64_t hash;
+    size_t offset;
+    size_t len;
+};
+
+struct string_set {
+    char *arena;
+    size_t arena_used;
+    size_t arena_cap;
+    struct string_entry *entries;
+    int count;
+    int entries_cap;
+    uint32_t *slots;
+    size_t num_slots; // always a power of two
+};
+
+void string_set_init(struct string_set *set) {
+    memset(set, 0, sizeof(*set));
+}
+
+void string_set_free(struct string_set *set) {
+    free(set->arena);
+    free(set->entries);
+    free(set->slots);
+    memset(set, 0, sizeof(*set));
+}
+
+/*
+Function Description: returns the i-th unique word of the set as a NUL-terminated string.
+*/
+const char *string_set_word(const struct string_set *set, int i) {
+    return set->arena + set->entries[i].offset;
+}
+
+/*
+Function Description: doubles the slot table and re-inserts every entry using its stored
+hash, so the words themselves are never touched. Returns 1 on success, 0 on failure.
+*/
+int string_set_grow_slots(struct string_set *set) {
+    size_t num_slots = set->num_slots ? set->num_slots * 2 : 1024;
+    uint32_t *slots = (uint32_t *)calloc(num_slots, sizeof(uint32_t));
+    if (slots == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < set->count; i++) {
+        size_t slot = set->entries[i].hash & (num_slots - 1);
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & (num_slots - 1);
         }
+        slots[slot] = (uint32_t)i + 1;
     }
-    return 0;
+    free(set->slots);
+    set->slots = slots;
+    set->num_slots = num_slots;
+    return 1;
+}
+
+/*
+Function Description: walks the probe sequence of 'hash' and returns the slot that holds the
+word equal to the 'len' bytes at 'word', or the empty slot where it would be inserted.
+*/
+size_t string_set_find_slot(const struct string_set *set, const char *word, size_t len, uint64_t hash) {
+    size_t slot = hash & (set->num_slots - 1);
+    while (set->slots[slot] != 0) {
+        const struct string_entry *entry = &set->entries[set->slots[slot] - 1];
+        if (entry->hash == hash && entry->len == len &&
+            memcmp(set->arena + entry->offset, word, len) == 0) {
+            break;
+        }
+        slot = (slot + 1) & (set->num_slots - 1);
+    }
+    return slot;
+}
+
+/*
+Function Description: returns 1 if the 'len' bytes at 'word' are one of the set's words.
+*/
+int string_set_contains(const struct string_set *set, const char *word, size_t len) {
+    if (set->num_slots == 0) {
+        return 0;
+    }
+    return set->slots[string_set_find_slot(set, word, len, string_hash(word, len))] != 0;
+}
+
+/*
+Function Description: adds the 'len' bytes at 'word' to the set unless an equal word is
+already in it. The slot table is kept at most half full, so a probe sequence is short.
+Returns 1 if the word was new, 0 if it was a duplicate and -1 if memory allocation failed.
+*/
+int string_set_insert(struct string_set *set, const char *word, size_t len) {
+    if ((size_t)(set->count + 1) * 2 > set->num_slots && !string_set_grow_slots(set)) {
+        return -1;
+    }
+    uint64_t hash = string_hash(word, len);
+    size_t slot = string_set_find_slot(set, word, len, hash);
+    if (set->slots[slot] != 0) {
+        return 0;
+    }
+
+    if (set->count == set->entries_cap) {
+        int entries_cap = set->entries_cap ? set->entries_cap * 2 : 1024;
+        struct string_entry *entries = (struct string_entry *)realloc(set->entries, entries_cap * sizeof(struct string_entry));
+        if (entries == NULL) {
+            return -1;
+        }
+        set->entries = entries;
+        set->entries_cap = entries_cap;
+    }
+    if (set->arena_used + len + 1 > set->arena_cap) {
+        size_t arena_cap = set->arena_cap ? set->arena_cap * 2 : 16384;
+        while (set->arena_used + len + 1 > arena_cap) {
+            arena_cap *= 2;
+        }
+        char *arena = (char *)realloc(set->arena, arena_cap);
+        if (arena == NULL) {
+            return -1;
+        }
+        set->arena = arena;
+        set->arena_cap = arena_cap;
+    }
+
+    struct string_entry *entry = &set->entries[set->count];
+    entry->hash = hash;
+    entry->offset = set->arena_used;
+    entry->len = len;
+    memcpy(set->arena + set->arena_used, word, len);
+    set->arena[set->arena_used + len] = '\0';
+    set->arena_used += len + 1;
+    set->slots[slot] = (uint32_t)set->count + 1;
+    set->count++;
+    return 1;
+}
+
+/*
+Function Description: returns the current wall-clock time in seconds from a monotonic clock.
+clock() measures the CPU time of the process instead, which is not comparable with the
+omp_get_wtime() timings of the parallel program (and stops advancing while waiting on I/O).
+*/
+double wall_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+Function Description: reads the next whitespace separated token of 'file' into '*buffer',
+growing it (and '*capacity') as needed, so a token of any length is read whole, like
+fscanf("%s") would read it but without a fixed size buffer to overflow. Returns the token's
+length, -1 at the end of the file, or -2 if memory allocation has failed.
+*/
+long read_token(FILE *file, char **buffer, size_t *capacity) {
+    int c;
+    do {
+        c = getc(file);
+    } while (c != EOF && isspace(c));
+    if (c == EOF) {
+        return -1;
+    }
+    size_t len = 0;
+    while (c != EOF && !isspace(c)) {
+        if (len + 1 >= *capacity) {
+            size_t grown_capacity = *capacity * 2;
+            char *grown = (char *)realloc(*buffer, grown_capacity);
+            if (grown == NULL) {
+                return -2;
+            }
+            *buffer = grown;
+            *capacity = grown_capacity;
+        }
+        (*buffer)[len++] = (char)c;
+        c = getc(file);
+    }
+    (*buffer)[len] = '\0';
+    return (long)len;
 }
 
 /*
 Function Description: Reads strings from text file specified by a 'filename' and stores 
-unique words in a dynamically allocated array. It also keeps track of the number of strings
-read 'num_strings', the total number of strings read across the file 'total_strings', and 
-the total time taken for reading_and counting the unique words 'total_read_time'. While 
-reading from the file using fscanf, it checks if the read strings is duplicated using the
-duplicated_strings function. If the string's nont a duplicate, it dynamically allocates
-memory for the new string and adds it to the strings_arr. 
-
-***strings_arr: creates an array of strings, where each string is a pointer to an array of
-characters. Used to pass address of the array of strings between functions so that the array
-can be dynamically allocated and modified.
-*/
-int read_strings_from_file(const char *filename, char ***strings_arr, int *num_strings, int *total_strings, double *total_read_time) {
+the unique words in the string set 'set'. It also keeps track of the total number of strings
+read across the file 'total_strings', the size of the file in 'bytes_read', and the total time
+taken for reading and counting the unique words. While reading from the file with read_token, every string is offered to
+string_set_insert, which hashes it and only copies it into the set's arena if it has not
+been seen before, so each string costs O(1) amortized instead of a scan over every unique
+word read so far. The number of unique words is available afterwards as set->count.
+*/
+int read_strings_from_file(const char *filename, struct string_set *set, int *total_strings, size_t *bytes_read, double *total_read_time) {
     FILE *file = fopen(filename, "r");
     if (file == NULL) {
         perror("There's an error opening this text file");
         return 0;
     }
-    *strings_arr = NULL;
-    *num_strings = 0;
-    char buffer[MAX_STRING_LEN];  // temporary buffer to read strings
+    string_set_init(set);
+    size_t capacity = MAX_STRING_LEN;  // the token buffer grows for longer strings
+    char *buffer = (char *)malloc(capacity);
+    if (buffer == NULL) {
+        perror("Memory allocation has failed");
+        fclose(file);
+        return 0;
+    }
 
-    clock_t start_time, end_time;
+    double start_time, end_time;
     double process_time;
 
-    start_time = clock();
+    start_time = wall_time();
 
-    while (fscanf(file, "%s", buffer) != EOF) {
+    long len;
+    while ((len = read_token(file, &buffer, &capacity)) >= 0) {
         (*total_strings)++;
-        if (!duplicated_strings(buffer, *strings_arr, *num_strings)) {
-            // if the string is not a duplicated string, add it to the array of strings.
-            (*num_strings)++;
-            /*
-            strings_arr: dereferenced to access the pointer to the array strings.
-            realloc dynamically resizes the array of strings. It returns a pointer to the
-            newly allocated memory block, and *strings_arr is updated to point to this
-            new memory block.
-            */
-            *strings_arr = (char **)realloc(*strings_arr, (*num_strings) * sizeof(char *));
-            if (*strings_arr == NULL) {
-                perror("Memory allocation has failed");
-                fclose(file);
-                return 0;
-            }
-            /*
-            *strings_arr is used to access the array of strings, whereas (*num_strings) - 1
-            is used to index the last element in the array of strings. 'strdup' is used to 
-            duplicate the contents of buffer and allocate memory for the new string. The 
-            pointer to this newly allocated memory is stored in the array of strings.
-            */
-            (*strings_arr)[(*num_strings) - 1] = strdup(buffer);
-            if ((*strings_arr)[(*num_strings) - 1] == NULL) {
-                perror("Memory allocation has failed");
-                fclose(file);
-                return 0;
-            }
+        // the set copies the string into its arena only if it has not been seen before
+        if (string_set_insert(set, buffer, (size_t)len) < 0) {
+            break;
         }
     }
+    free(buffer);
+    if (len != -1) {
+        perror("Memory allocation has failed");
+        string_set_free(set);
+        fclose(file);
+        return 0;
+    }
+    long file_size = ftell(file);
+    if (file_size > 0) {
+        *bytes_read += (size_t)file_size;
+    }
     fclose(file);
 
-    end_time = clock();
-    process_time = ((double)(end_time - start_time)) / CLOCKS_PER_SEC;
+    end_time = wall_time();
+    process_time = end_time - start_time;
     *total_read_time += process_time; // Accumulate the read time
     printf("\nReading the file and counting the number of unique strings, Process time (seconds): %1f\n", process_time);
 
     return 1;
 }
 
+/*
+Struct Description: the bloom filter's bit array, packed 64 bits to a uint64_t word and
+addressed by bit index: bit i lives in words[i / 64] under the mask 1 << (i % 64). Compared
+to one int per bit this takes 32 times less memory, so far larger filters stay in cache.
+*/
+struct bloom_filter {
+    uint64_t *words;
+    size_t num_words;
+    uint64_t m;            // a power of two
+    int k;
+};
+
+/*
+Function Description: allocates a zeroed filter of 'm' bits (a power of two) and 'k' bits per
+word. Returns 1 on success, 0 if memory allocation has failed.
+*/
+int bloom_filter_init(struct bloom_filter *filter, uint64_t m, int k) {
+    filter->m = m;
+    filter->k = k;
+    filter->num_words = (size_t)((m + 63) / 64);
+    filter->words = (uint64_t *)calloc(filter->num_words, sizeof(uint64_t));
+    return filter->words != NULL;
+}
+
+void bloom_filter_free(struct bloom_filter *filter) {
+    free(filter->words);
+    filter->words = NULL;
+}
+
+size_t bloom_filter_bytes(const struct bloom_filter *filter) {
+    return filter->num_words * sizeof(uint64_t);
+}
+
+/*
+Function Description: sets the k bits of a word in the filter. The word is
+given by its 64-bit 'hash' (as stored in the string set), and the k bit indices are derived
+from it by double hashing, so the word itself is never hashed again.
+*/
+void bloom_insert(struct bloom_filter *filter, uint64_t hash) {
+    uint64_t h2 = bloom_second_hash(hash);
+    for (int j = 0; j < filter->k; j++) {
+        uint64_t index = bloom_probe_index(hash, h2, j, filter->m - 1);
+        filter->words[index >> 6] |= 1ULL << (index & 63);
+    }
+}
+
+/*
+Function Description: returns 1 if all k bits of the word with 64-bit
+'hash' are set (the word is potentially in the filter), 0 as soon as one of them is not.
+*/
+int bloom_query(const struct bloom_filter *filter, uint64_t hash) {
+    uint64_t h2 = bloom_second_hash(hash);
+    for (int j = 0; j < filter->k; j++) {
+        uint64_t index = bloom_probe_index(hash, h2, j, filter->m - 1);
+        if ((filter->words[index >> 6] & (1ULL << (index & 63))) == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+Function Description: measures the real false positive rate of a filter built from the words
+in 'set'. It queries FP_TEST_WORDS held-out words that are derived from the file's own
+words (word + "#" + counter, so they have a realistic length and alphabet) and are checked
+against the set to make sure none of them was actually inserted. The fraction of those
+words that the filter reports as present is the empirical false positive rate. The held-out
+words are generated and hashed first, so the wall time of the lookups alone is added to
+'query_time' and their number to 'queries'.
+*/
+double measure_false_positive_rate(const struct bloom_filter *filter, const struct string_set *set, double *queries, double *query_time) {
+    int tested = 0;
+    int false_positives = 0;
+    // strings have no length limit, so the probe buffer fits the longest word plus "#" and the counter
+    size_t longest = 0;
+    for (int i = 0; i < set->count; i++) {
+        longest = set->entries[i].len > longest ? set->entries[i].len : longest;
+    }
+    size_t capacity = longest + 16;
+    char *probe = (char *)malloc(capacity);
+    uint64_t *hashes = (uint64_t *)malloc(FP_TEST_WORDS * sizeof(uint64_t));
+    if (hashes == NULL || probe == NULL) {
+        perror("Memory allocation has failed");
+        free(probe);
+        free(hashes);
+        return 0.0;
+    }
+
+    for (int t = 0; t < FP_TEST_WORDS && set->count > 0; t++) {
+        int len = snprintf(probe, capacity, "%s#%d", string_set_word(set, t % set->count), t);
+        if (string_set_contains(set, probe, len)) {
+            continue;
+        }
+        hashes[tested++] = string_hash(probe, len);
+    }
+
+    double start_time = wall_time();
+    for (int t = 0; t < tested; t++) {
+        false_positives += bloom_query(filter, hashes[t]);
+    }
+    *query_time += wall_time() - start_time;
+    *queries += tested;
+    free(probe);
+    free(hashes);
+    return tested > 0 ? (double)false_positives / tested : 0.0;
+}
+
+/*
+Function Description: returns 'count' divided by 'seconds', or 0 when no time was measured.
+*/
+double per_second(double count, double seconds) {
+    return seconds > 0.0 ? count / seconds : 0.0;
+}
+
 /*
 Approach description: the main function is the entry point of the program, where all the
 processing occurs. It is defined with an array of filenames for text files to be processed 
@@ -138,71 +468,94 @@ through each text files, while utilising the read_strings_from_file to read and
 unique words in each file. (Bloom filter starts) It will then calculate the optimal size of 
 the bit array 'm' and the false positive rate for the bloom filter. It will then create the 
 optimal sized bit array and insert the hash values of the unique strings using the 
-division_method_hash function.It also includes a tester to check if a string exist within the
-bloom filter. Lastly it frees up the memory allocated for the file's strings.
+string_hash function and double hashing. It also includes a tester to check if a string exist within the
+bloom filter. Lastly it frees up the memory allocated for the file's strings. Files named on
+the command line replace the default list, and -m adds the same machine-readable
+"metric <name> <value>" lines as the parallel program, for bench/run_bench.sh.
 */
-int main() {
-    const char *filenames[] = {"MOBY_DICK.txt", "LITTLE_WOMEN.txt", "SHAKESPEARE.txt"}; // Add more filenames as needed
-    int num_files = sizeof(filenames) / sizeof(filenames[0]);
+int main(int argc, char *argv[]) {
+    const char *default_filenames[] = {"MOBY_DICK.txt", "LITTLE_WOMEN.txt"}; // Add more filenames as needed
+    const char **filenames = default_filenames;
+    int num_files = sizeof(default_filenames) / sizeof(default_filenames[0]);
+    int print_metrics = 0;
+
+    int option;
+    while ((option = getopt(argc, argv, "m")) != -1) {
+        if (option != 'm') {
+            fprintf(stderr, "Usage: %s [-m] [file ...]\n", argv[0]);
+            return 1;
+        }
+        print_metrics = 1;
+    }
+    if (optind < argc) {
+        filenames = (const char **)&argv[optind];
+        num_files = argc - optind;
+    }
 
-    char **strings_arr = NULL;
-    int num_strings = 0;
+    struct string_set set;
     int total_strings = 0;
-    int m = 0;
+    uint64_t m = 0;
+    int k = 0;
     double false_positive_rate;
-    clock_t start_optimization_time, end_optimization_time, total_start_time, total_end_time;
+    double start_optimization_time, end_optimization_time, total_start_time, total_end_time;
     double optimization_process_time, total_process_time;
+    size_t total_bytes_read = 0;
+    size_t total_filter_bytes = 0;
+    double total_inserts = 0.0, total_insert_time = 0.0;
+    double total_queries = 0.0, total_query_time = 0.0;
+    double total_false_positives = 0.0;
     double total_read_time = 0.0; // Track total time for reading and counting unique words
     double total_optimization_time = 0.0; // Track total time for optimization and insertion
     int total_unique_words = 0; // Track total unique words across all files
 
-    total_start_time = clock();
+    total_start_time = wall_time();
 
     for (int i = 0; i < num_files; i++) {
         //passing address by reference from the read_strings_from_file function
-        if (read_strings_from_file(filenames[i], &strings_arr, &num_strings, &total_strings, &total_read_time)) {
-            total_unique_words += num_strings; // Accumulate unique words count
+        if (read_strings_from_file(filenames[i], &set, &total_strings, &total_bytes_read, &total_read_time)) {
+            total_unique_words += set.count; // Accumulate unique words count
 
-            printf("Initial bit array size based on the number of unique words in %s: %d\n", filenames[i], num_strings);
-            int n = num_strings;
+            printf("Initial bit array size based on the number of unique words in %s: %d\n", filenames[i], set.count);
+            int n = set.count;
 
-            start_optimization_time = clock();
+            start_optimization_time = wall_time();
             m = calc_optimum_bitArraySize(n, MAX_FP_RATE);
 
-            false_positive_rate = pow(1 - pow(1 - (1.0 / m), NUM_HASH_FUNCTIONS * n), NUM_HASH_FUNCTIONS);
-            printf("False Positive Rate: %f\n", false_positive_rate);
-	    
-	    /*
-	    *bit_array is used to create a dynamically allocated array of integers.
-	    'calloc' will then allocate memory for an array of 'm' integers, and *bit_array
-	    points to the start of this allocated memory block.
-	    */
-            int *bit_array = (int *)calloc(m, sizeof(int));
-            if (bit_array == NULL) {
+            k = calc_optimum_hash_functions(n, m);
+            false_positive_rate = pow(1 - pow(1 - (1.0 / m), (double)k * n), k);
+            printf("False Positive Rate: %f (m = %llu bits, k = %d)\n", false_positive_rate, (unsigned long long)m, k);
+
+            /*
+            the filter packs its 'm' bits into uint64_t words, so it takes m / 8 bytes instead
+            of the m * sizeof(int) bytes a one-int-per-bit array would need.
+            */
+            struct bloom_filter filter;
+            if (!bloom_filter_init(&filter, m, k)) {
                 perror("Memory allocation has failed");
                 return 1;
             }
 
-            for (int i = 0; i < num_strings; i++) {
-                for (int j = 0; j < NUM_HASH_FUNCTIONS; j++) {
-                    int hash = division_method_hash(strings_arr[i], m);
-                    bit_array[hash] = 1;
-                }
+            double insert_start_time = wall_time();
+            for (int i = 0; i < set.count; i++) {
+                bloom_insert(&filter, set.entries[i].hash);
             }
-            end_optimization_time = clock();
-            optimization_process_time = ((double)(end_optimization_time - start_optimization_time)) / CLOCKS_PER_SEC;
+            end_optimization_time = wall_time();
+            total_inserts += set.count;
+            total_insert_time += end_optimization_time - insert_start_time;
+            optimization_process_time = end_optimization_time - start_optimization_time;
             total_optimization_time += optimization_process_time; // Accumulate the optimization time
             printf("Total time for optimization and insertion (seconds): %lf\n", optimization_process_time);
 
+            double file_queries = 0.0;
+            double empirical_rate = measure_false_positive_rate(&filter, &set, &file_queries, &total_query_time);
+            total_queries += file_queries;
+            total_false_positives += empirical_rate * file_queries;
+            printf("Empirical False Positive Rate (held-out words): %f\n", empirical_rate);
+            printf("Bit array memory (bytes): %zu (one int per bit would use %zu)\n", bloom_filter_bytes(&filter), (size_t)m * sizeof(int));
+            total_filter_bytes += bloom_filter_bytes(&filter);
+
             const char *query = "geohash";
-            int is_present = 1;
-            for (int j = 0; j < NUM_HASH_FUNCTIONS; j++) {
-                int hash = division_method_hash(query, m);
-                if (bit_array[hash] == 0) {
-                    is_present = 0;
-                    break;
-                }
-            }
+            int is_present = bloom_query(&filter, string_hash(query, strlen(query)));
             
             if (is_present) {
                 printf("The string '%s' is potentially in the bloom filter.\n", query);
@@ -212,14 +565,9 @@ int main() {
                 printf("The string '%s' does not exist in the bloom filter.\n", query);
             }
 
-            // Free memory allocated for this file's strings
-            // strings_arr[i] is used to access individual strings in the array of strings
-            //dereferenced to get the pointer to the specific string to be freed.
-            for (int i = 0; i < num_strings; i++) {
-                free(strings_arr[i]);
-            }
-            free(strings_arr);
-            free(bit_array);
+            // Free the file's unique words; the set owns all of them in its arena
+            string_set_free(&set);
+            bloom_filter_free(&filter);
         } 
         
         else {
@@ -227,15 +575,28 @@ int main() {
         }
     }
 
-    total_end_time = clock();
+    total_end_time = wall_time();
 
-    printf("\nOptimal bit array size based on calculations: %d\n", m);
+    printf("\nOptimal bit array size based on calculations: %llu\n", (unsigned long long)m);
     printf("Total unique strings from all files: %d\n", total_unique_words);
     printf("Total time for reading and counting unique words (seconds): %lf\n", total_read_time);
     printf("Total time for optimization and insertion (seconds): %lf\n", total_optimization_time);
-    total_process_time = ((double)(total_end_time - total_start_time)) / CLOCKS_PER_SEC;
+    total_process_time = total_end_time - total_start_time;
     printf("Total Process time (seconds): %lf\n\n", total_process_time);
 
+    if (print_metrics) {
+        printf("metric threads 1\n");
+        printf("metric bytes_read %zu\n", total_bytes_read);
+        printf("metric tokens %d\n", total_strings);
+        printf("metric unique_words %d\n", total_unique_words);
+        printf("metric ingest_mb_per_s %f\n", per_second(total_bytes_read / 1e6, total_read_time));
+        printf("metric total_seconds %f\n", total_process_time);
+        printf("metric classic_filter_bytes %zu\n", total_filter_bytes);
+        printf("metric classic_inserts_per_s %f\n", per_second(total_inserts, total_insert_time));
+        printf("metric classic_queries_per_s %f\n", per_second(total_queries, total_query_time));
+        printf("metric classic_empirical_fpr %f\n", total_queries > 0 ? total_false_positives / total_queries : 0.0);
+    }
+
     return 0;
 }
 